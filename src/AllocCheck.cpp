@@ -0,0 +1,128 @@
+#include "AllocCheck.hpp"
+
+#ifdef FM_ALLOC_CHECK
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+#if __cplusplus >= 201103L
+#define ALLOC_THROWS
+#define ALLOC_NOTHROW noexcept
+#else
+#define ALLOC_THROWS throw(std::bad_alloc)
+#define ALLOC_NOTHROW throw()
+#endif
+
+static bool armed = false;
+static unsigned long allocations = 0;
+
+
+static void *allocate(size_t size)
+{
+    if (__atomic_load_n(&armed, __ATOMIC_RELAXED))
+    {
+#ifdef FM_ALLOC_ABORT
+        static char const message[] = "Heap allocation during playback\n";
+        // Not through stdio, that may allocate as well
+        ssize_t written = write(2, message, sizeof(message) - 1);
+        (void)written;
+        std::abort();
+#endif
+        __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    }
+    return std::malloc(size ? size : 1);
+}
+
+
+void *operator new(size_t size) ALLOC_THROWS
+{
+    void *p = allocate(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+
+void *operator new[](size_t size) ALLOC_THROWS
+{
+    void *p = allocate(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+
+void *operator new(size_t size, std::nothrow_t const &) ALLOC_NOTHROW
+{
+    return allocate(size);
+}
+
+
+void *operator new[](size_t size, std::nothrow_t const &) ALLOC_NOTHROW
+{
+    return allocate(size);
+}
+
+
+void operator delete(void *p) ALLOC_NOTHROW
+{
+    std::free(p);
+}
+
+
+void operator delete[](void *p) ALLOC_NOTHROW
+{
+    std::free(p);
+}
+
+
+#if __cplusplus >= 201402L
+void operator delete(void *p, size_t) ALLOC_NOTHROW
+{
+    std::free(p);
+}
+
+
+void operator delete[](void *p, size_t) ALLOC_NOTHROW
+{
+    std::free(p);
+}
+#endif
+
+
+void operator delete(void *p, std::nothrow_t const &) ALLOC_NOTHROW
+{
+    std::free(p);
+}
+
+
+void operator delete[](void *p, std::nothrow_t const &) ALLOC_NOTHROW
+{
+    std::free(p);
+}
+
+
+/* Start counting, everything before is setup and may allocate */
+void alloc_check_begin()
+{
+    __atomic_store_n(&allocations, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&armed, true, __ATOMIC_RELEASE);
+}
+
+
+/* Stop counting and return the number of allocations since
+ * alloc_check_begin()
+ */
+unsigned long alloc_check_end()
+{
+    __atomic_store_n(&armed, false, __ATOMIC_RELEASE);
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+
+void alloc_check_report()
+{
+    unsigned long count = alloc_check_end();
+    std::fprintf(stderr, "%lu heap allocations during playback\n", count);
+}
+
+#endif
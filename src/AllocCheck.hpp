@@ -0,0 +1,31 @@
+#ifndef FM_ALLOCCHECK_HPP
+#define FM_ALLOCCHECK_HPP
+
+/* Checks that playback doesn't touch the heap. Built with make
+ * ALLOC_CHECK=1, the global operator new and delete are replaced and
+ * every allocation between ALLOC_CHECK_BEGIN() and ALLOC_CHECK_END() is
+ * counted, on any thread. ALLOC_CHECK_END() prints how many there were.
+ * With make ALLOC_CHECK=abort the first one aborts instead, so a
+ * debugger shows where it came from. Without it the macros are empty
+ * and cost nothing.
+ *
+ * Only operator new is watched, not malloc() itself.
+ */
+
+#ifdef FM_ALLOC_CHECK
+
+void alloc_check_begin();
+unsigned long alloc_check_end();
+void alloc_check_report();
+
+#define ALLOC_CHECK_BEGIN() alloc_check_begin()
+#define ALLOC_CHECK_END() alloc_check_report()
+
+#else
+
+#define ALLOC_CHECK_BEGIN()
+#define ALLOC_CHECK_END()
+
+#endif
+
+#endif
@@ -0,0 +1,184 @@
+#include "Analyzer.hpp"
+#include "DriveManager.hpp"
+#include "MidiEvents.hpp"
+#include "Output.hpp"
+#include "Player.hpp"
+#include <cmath>
+#include <iomanip>
+#include <set>
+
+
+/* Output that only counts the steps of every drive */
+class StepCounter : public Output
+{
+    private:
+    std::vector<long long> &m_steps;
+
+    public:
+    StepCounter(std::vector<long long> &steps) : m_steps(steps)
+    {}
+
+    virtual void setup(Drive const &drive)
+    {}
+
+    virtual void direction(Drive const &drive, bool forward)
+    {}
+
+    virtual void step(Drive const &drive)
+    {
+        ++m_steps[drive.index];
+    }
+
+    virtual void flush()
+    {}
+};
+
+
+static int count_for(std::map<int, int> const &counts, int key)
+{
+    std::map<int, int>::const_iterator c = counts.find(key);
+    return c == counts.end() ? 0 : c->second;
+}
+
+
+Analyzer::Analyzer(DriveList const &drives, double drop_factor) :
+    m_drives(drives), m_drop_factor(drop_factor), m_ticks(0),
+    m_peak_polyphony(0), m_polyphony_ticks(0),
+    m_busy_ticks(drives.size(), 0), m_steps(drives.size(), 0),
+    m_cents_sum(0), m_cents_count(0), m_worst_cents(0), m_worst_note(-1)
+{}
+
+
+/* Play the given (merged and transformed) event list on the virtual
+ * clock. Every tick of the drive engine is simulated, so the step
+ * counts are exactly the ones the hardware would see.
+ */
+void Analyzer::run(EventList const &events)
+{
+    StepCounter counter(m_steps);
+    DriveManager dmgr(m_drives, counter);
+    Player player(dmgr, m_drives, m_drop_factor, false);
+    int dcount = m_drives.size();
+    // Playing notes, by channel/note
+    std::set<int> sounding;
+    long long due;
+
+    for (EventList::const_iterator event = events.begin();
+            event != events.end(); ++event)
+    {
+        due = (*event)->absolute_nsec * RESOLUTION / 1000000000;
+        while (m_ticks < due)
+        {
+            dmgr.tick();
+            for (int d = 0; d < dcount; ++d)
+            {
+                if (dmgr.playing(d)) ++m_busy_ticks[d];
+            }
+            m_polyphony_ticks += sounding.size();
+            ++m_ticks;
+        }
+
+        if ((*event)->type() == Event_Note_On)
+        {
+            NoteOnEvent *e = dynamic_cast<NoteOnEvent*>(*event);
+            if (e->muted) continue;
+            int key = (e->getChannel() << 7) | e->getNote();
+            if (sounding.insert(key).second)
+            {
+                ++m_notes[e->source];
+            }
+            if ((int)sounding.size() > m_peak_polyphony)
+            {
+                m_peak_polyphony = sounding.size();
+            }
+
+            if (player.noteOn(e->getChannel(), e->getNote(), e->group,
+                        e->source) == -1)
+            {
+                continue;
+            }
+
+            // The note got a drive, how far off is it?
+            double frequency = player.frequency(e->getNote());
+            int ticks = DriveManager::ticksFor(frequency);
+            double played = (double)RESOLUTION / (ticks < 1 ? 1 : ticks);
+            double cents = 1200 * std::log(played / frequency) / std::log(2.0);
+            m_cents_sum += std::fabs(cents);
+            ++m_cents_count;
+            if (std::fabs(cents) > std::fabs(m_worst_cents))
+            {
+                m_worst_cents = cents;
+                m_worst_note = e->getNote();
+            }
+        }
+        else
+        {
+            if ((*event)->type() == Event_Note_Off)
+            {
+                NoteOffEvent *e = dynamic_cast<NoteOffEvent*>(*event);
+                sounding.erase((e->getChannel() << 7) | e->getNote());
+            }
+            player.handle(*event);
+        }
+    }
+    m_dropped = player.dropped();
+}
+
+
+void Analyzer::report(std::ostream &out) const
+{
+    long long seconds = m_ticks / RESOLUTION;
+    int notes = 0;
+    int dropped = 0;
+    for (std::map<int, int>::const_iterator n = m_notes.begin();
+            n != m_notes.end(); ++n)
+    {
+        notes += n->second;
+    }
+    for (std::map<int, int>::const_iterator d = m_dropped.begin();
+            d != m_dropped.end(); ++d)
+    {
+        dropped += d->second;
+    }
+
+    out << std::fixed << std::setprecision(1)
+        << "Duration:     " << seconds / 60 << ":" << std::setw(2)
+        << std::setfill('0') << seconds % 60 << std::setfill(' ') << "\n"
+        << "Notes:        " << notes << ", " << dropped << " dropped\n"
+        << "Polyphony:    peak " << m_peak_polyphony << ", average "
+        << (m_ticks ? (double)m_polyphony_ticks / m_ticks : 0.0) << "\n"
+        << "Drives:       " << m_drives.size() << " configured, "
+        << m_peak_polyphony << " needed to play every note\n";
+
+    if (dropped)
+    {
+        out << "Dropped notes per track/channel:\n";
+        for (std::map<int, int>::const_iterator d = m_dropped.begin();
+                d != m_dropped.end(); ++d)
+        {
+            out << "  track " << (d->first >> 4) << " channel "
+                << (d->first & 0xF) << ": " << d->second << " of "
+                << count_for(m_notes, d->first) << "\n";
+        }
+    }
+
+    out << "Drive utilization:\n";
+    for (size_t d = 0; d < m_drives.size(); ++d)
+    {
+        out << "  drive " << d << ": "
+            << (m_ticks ? 100.0 * m_busy_ticks[d] / m_ticks : 0.0)
+            << "% (" << m_steps[d] << " steps)\n";
+    }
+
+    out << "Pitch error:  ";
+    if (m_cents_count)
+    {
+        out << "average " << m_cents_sum / m_cents_count
+            << " cents, worst " << m_worst_cents << " cents (note "
+            << m_worst_note << ") at " << RESOLUTION << " ticks/s\n";
+    }
+    else
+    {
+        out << "no notes played\n";
+    }
+}
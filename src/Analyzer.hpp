@@ -0,0 +1,39 @@
+#ifndef FM_ANALYZER_HPP
+#define FM_ANALYZER_HPP
+
+#include "DriveConfig.hpp"
+#include "MidiTrack.hpp"
+#include <map>
+#include <ostream>
+#include <vector>
+
+/* Runs the whole playback (player, drive allocation and the step
+ * engine) on a virtual clock as fast as possible, without sleeping and
+ * without touching any GPIO, and collects what would have happened.
+ */
+class Analyzer
+{
+    private:
+    DriveList m_drives;
+    double m_drop_factor;
+
+    long long m_ticks;
+    int m_peak_polyphony;
+    long long m_polyphony_ticks;
+    std::map<int, int> m_notes;
+    std::map<int, int> m_dropped;
+    std::vector<long long> m_busy_ticks;
+    std::vector<long long> m_steps;
+    double m_cents_sum;
+    int m_cents_count;
+    double m_worst_cents;
+    int m_worst_note;
+
+    public:
+    Analyzer(DriveList const &drives, double drop_factor);
+
+    void run(EventList const &events);
+    void report(std::ostream &out) const;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "Arguments.hpp"
+#include "TempoControl.hpp"
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -7,18 +8,67 @@
 #include <sstream>
 #include <unistd.h>
 
-Arguments arguments = {1, "drives.cfg", "", std::set<int>(), false};
+Arguments arguments = {1, "drives.cfg", "", std::set<int>(), false, false,
+    std::map<int, int>(), std::map<int, std::string>(), 0, 0, false, false,
+    false, "", 0, 50, "", 1, false, false, false, 1000, false, CATCH_UP_NONE,
+    std::map<std::string, std::string>(), "", "", 2};
 
 static int help = 0;
 
+// Codes for the options without a short version
+enum
+{
+    OPT_ROUTE = 256,
+    OPT_MIN_LENGTH,
+    OPT_MIN_VELOCITY,
+    OPT_METRICS,
+    OPT_WORKER,
+    OPT_PLAYOUT_DELAY,
+    OPT_LIVE,
+    OPT_SHARDS,
+    OPT_BENCH_IO,
+    OPT_BENCH_ENGINE,
+    OPT_BENCH_PARSE,
+    OPT_TEMPO,
+    OPT_TEMPO_KEYS,
+    OPT_CATCH_UP,
+    OPT_STREAM,
+    OPT_TRACE,
+    OPT_HEAD_STATE,
+    OPT_LOOKAHEAD
+};
+
 static option long_opts[] = {
     // Arguments
     {"dropfactor", required_argument, 0, 'd'},
     {"configpath", required_argument, 0, 'c'},
     {"mute",       required_argument, 0, 'm'},
+    {"transpose",  required_argument, 0, 't'},
+    {"render",     required_argument, 0, 'w'},
+    {"route",      required_argument, 0, OPT_ROUTE},
+    {"min-length", required_argument, 0, OPT_MIN_LENGTH},
+    {"min-velocity", required_argument, 0, OPT_MIN_VELOCITY},
+    {"worker",     required_argument, 0, OPT_WORKER},
+    {"playout-delay", required_argument, 0, OPT_PLAYOUT_DELAY},
+    {"live",       required_argument, 0, OPT_LIVE},
+    {"shards",     required_argument, 0, OPT_SHARDS},
+    {"tempo",      required_argument, 0, OPT_TEMPO},
+    {"catch-up",   required_argument, 0, OPT_CATCH_UP},
+    {"stream",     required_argument, 0, OPT_STREAM},
+    {"trace",      required_argument, 0, OPT_TRACE},
+    {"head-state", required_argument, 0, OPT_HEAD_STATE},
+    {"lookahead",  required_argument, 0, OPT_LOOKAHEAD},
     // Flags
     {"help",       no_argument,       &help, 1},
     {"lyrics",     no_argument,       0, 'l'},
+    {"reactor",    no_argument,       0, 'r'},
+    {"dedup",      no_argument,       0, 'u'},
+    {"analyze",    no_argument,       0, 'a'},
+    {"metrics",    no_argument,       0, OPT_METRICS},
+    {"bench-io",   no_argument,       0, OPT_BENCH_IO},
+    {"bench-engine", no_argument,     0, OPT_BENCH_ENGINE},
+    {"bench-parse", no_argument,      0, OPT_BENCH_PARSE},
+    {"tempo-keys", no_argument,       0, OPT_TEMPO_KEYS},
 
     {0, 0, 0, 0}
 };
@@ -26,13 +76,32 @@ static option long_opts[] = {
 
 static void print_usage()
 {
-    std::cout << "Usage: floppymusic [-c PATH] [-d FACTOR] [-m MUTE] [-l] MIDIFILE" << std::endl;
+    std::cout << "Usage: floppymusic [-c PATH] [-d FACTOR] [-m MUTE] [-l] [-r] [-a]\n"
+        "                   [-t TRANSPOSE] [-u] [--route ROUTE]\n"
+        "                   [--min-length MSEC] [--min-velocity VEL]\n"
+        "                   [--metrics] [-w WAVFILE] [--playout-delay MSEC]\n"
+        "                   [--shards N] [--tempo PERCENT] [--tempo-keys]\n"
+        "                   [--catch-up POLICY] [--trace JSONFILE]\n"
+        "                   [--head-state FILE] [--lookahead MSEC] MIDIFILE\n"
+        "       floppymusic [-c PATH] [-d FACTOR] [-t TRANSPOSE] [--tempo PERCENT]\n"
+        "                   [--catch-up POLICY] --stream GROUP=MIDIFILE ...\n"
+        "       floppymusic [-c PATH] --worker PORT\n"
+        "       floppymusic [-c PATH] [-d FACTOR] [-t TRANSPOSE] [--route ROUTE]\n"
+        "                   [--min-velocity VEL] --live DEVICE\n"
+        "       floppymusic [-c PATH] --bench-io | --bench-engine\n"
+        "       floppymusic --bench-parse MIDIFILE"
+        << std::endl;
 }
 
 
 static void print_help()
 {
     std::cout <<
+        "-a, --analyze            Don't play the file, but simulate the\n"
+        "                         playback as fast as possible and report\n"
+        "                         polyphony, dropped notes, drive usage and\n"
+        "                         pitch errors.\n"
+        "\n"
         "-c PATH, --configpath    Sets the path of the drive configuration file\n"
         "\n"
         "-d FACTOR, --dropfactor  Sets the 'drop factor'. A drop factor of 0\n"
@@ -41,13 +110,103 @@ static void print_help()
         "                         aves, while a negative integer makes every\n"
         "                         note higher.\n"
         "\n"
-        "-l, --lyrics             Print lyrics (if available)\n"
+        "-l, --lyrics             Print lyrics and text events (if\n"
+        "                         available)\n"
         "\n"
         "-m MUTE, --mute          Mutes channels. The format is\n"
         "                         track:channel,track:channel,... If only\n"
         "                         track is given then every channel on the\n"
         "                         track will be muted.\n"
         "\n"
+        "-r, --reactor            Play everything from a single thread\n"
+        "                         instead of a play and a drive thread.\n"
+        "                         Recommended for single core boards.\n"
+        "\n"
+        "-t TRANSPOSE,            Transposes channels. The format is\n"
+        "  --transpose            track:channel=semitones,... with the\n"
+        "                         channel being optional like for --mute.\n"
+        "\n"
+        "-u, --dedup              Don't play a note that is already played\n"
+        "                         on another channel.\n"
+        "\n"
+        "-w WAVFILE, --render     Don't play the file, but render what the\n"
+        "                         drives would sound like into WAVFILE.\n"
+        "\n"
+        "--route ROUTE            Plays channels only on the drives of a\n"
+        "                         group from the drive configuration. The\n"
+        "                         format is track:channel=group,...\n"
+        "\n"
+        "--min-length MSEC        Drops notes shorter than MSEC ms.\n"
+        "\n"
+        "--min-velocity VEL       Drops notes with a velocity below VEL.\n"
+        "\n"
+        "--metrics                Publishes live metrics in shared memory,\n"
+        "                         see floppymusic-stat.\n"
+        "\n"
+        "--worker PORT            Plays the drives of the configuration for\n"
+        "                         a coordinator on another host, which\n"
+        "                         sends its commands to UDP port PORT.\n"
+        "\n"
+        "--playout-delay MSEC     How far a coordinator sends its commands\n"
+        "                         ahead to the workers (default 50).\n"
+        "\n"
+        "--shards N               Splits the drives into N shards, each with\n"
+        "                         a drive thread on a core of its own. 0\n"
+        "                         uses every core but the first. Drives\n"
+        "                         can be put into a shard with shard= in\n"
+        "                         the drive configuration.\n"
+        "\n"
+        "--tempo PERCENT          Plays the song at PERCENT % of its tempo.\n"
+        "\n"
+        "--tempo-keys             Changes the tempo while the song plays:\n"
+        "                         + and - by 1 %, > and < by 0.1 %, 0 back\n"
+        "                         to the song's own tempo.\n"
+        "\n"
+        "--catch-up POLICY        What to do when the playback fell behind:\n"
+        "                         none plays the late events right away,\n"
+        "                         compress shortens the following gaps until\n"
+        "                         it's back on schedule, skip drops the notes\n"
+        "                         that are over already and resync jumps to\n"
+        "                         where the song should be, leaving out what\n"
+        "                         it missed but the notes that still sound.\n"
+        "                         Default none.\n"
+        "\n"
+        "--stream GROUP=MIDIFILE  Plays MIDIFILE on the drives of GROUP. Can\n"
+        "                         be given once per drive group, the songs\n"
+        "                         then play at the same time.\n"
+        "\n"
+        "--live DEVICE            Plays the raw MIDI stream from DEVICE (a\n"
+        "                         /dev/snd/midi* device, a named pipe or -\n"
+        "                         for stdin) as it comes in. The notes count\n"
+        "                         as track 0.\n"
+        "\n"
+        "--head-state FILE        Keeps the head positions of the drives in\n"
+        "                         FILE when floppymusic exits, so that the\n"
+        "                         next start doesn't have to reseed them.\n"
+        "\n"
+        "--lookahead MSEC         Hands the notes to the drive thread MSEC\n"
+        "                         ms before they are due (default 2), so\n"
+        "                         they start on the exact tick even if the\n"
+        "                         play thread wakes up late. 0 plays them\n"
+        "                         when it wakes up.\n"
+        "\n"
+        "--trace JSONFILE         Writes where the time went into JSONFILE,\n"
+        "                         for chrome://tracing or Perfetto. Needs a\n"
+        "                         build with make TRACE=1.\n"
+        "\n"
+        "--bench-io               Measures how long writing the pins of a\n"
+        "                         tick takes with the GPIO registers and\n"
+        "                         with the GPIO character device (the\n"
+        "                         gpiochip of the drive configuration or\n"
+        "                         /dev/gpiochip0).\n"
+        "\n"
+        "--bench-engine           Measures how long a tick takes with the\n"
+        "                         generic drive engine and with the one\n"
+        "                         compiled for the rig (make FIXED_RIG=...).\n"
+        "\n"
+        "--bench-parse            Measures how fast MIDIFILE is read, as a\n"
+        "                         whole and just decoding its tracks.\n"
+        "\n"
         "MIDIFILE                 The MIDI file that should be played."
         << std::endl;
 }
@@ -71,18 +230,75 @@ static void parse_muted(std::string &param)
 }
 
 
+/* Parses a comma separated list of track:channel=value entries and
+ * calls store for every track/channel combination and value. As with
+ * --mute the channel is optional.
+ */
+static void parse_assignments(char const *arg,
+        void (*store)(int combination, std::string const &value))
+{
+    std::stringstream ss(arg);
+    std::string param;
+    while (!ss.eof())
+    {
+        std::getline(ss, param, ',');
+        size_t eq = param.find('=');
+        if (eq == std::string::npos)
+        {
+            std::cerr << "Missing '=' in '" << param << "'" << std::endl;
+            std::exit(1);
+        }
+        std::string value = param.substr(eq + 1);
+        int track, channel;
+        int fields = std::sscanf(param.c_str(), "%i:%i", &track, &channel);
+        if (fields == 1)
+        {
+            for (int c = 0; c < 16; ++c)
+            {
+                store((track << 4) | c, value);
+            }
+        }
+        else if (fields == 2)
+        {
+            store((track << 4) | channel, value);
+        }
+        else
+        {
+            std::cerr << "Invalid track in '" << param << "'" << std::endl;
+            std::exit(1);
+        }
+    }
+}
+
+
+static void store_transpose(int combination, std::string const &value)
+{
+    arguments.transpose[combination] = std::atoi(value.c_str());
+}
+
+
+static void store_route(int combination, std::string const &value)
+{
+    arguments.routes[combination] = value;
+}
+
+
 void parse_args(int argc, char **argv)
 {
     int option_index = 0;
     int c;
     bool invalid = false;
-    while ((c = getopt_long(argc, argv, "c:d:hlm:", long_opts, &option_index)) != -1)
+    while ((c = getopt_long(argc, argv, "ac:d:hlm:rt:uw:", long_opts, &option_index)) != -1)
     {
         switch (c)
         {
             case 0:
                 // setting a flag
                 break;
+            case 'a':
+                // Analyze only
+                arguments.analyze = true;
+                break;
             case 'c':
                 // Config file path
                 arguments.cfg_path = std::string(optarg);
@@ -104,6 +320,133 @@ void parse_args(int argc, char **argv)
                 // Lyrics
                 arguments.lyrics = true;
                 break;
+            case 'r':
+                // Single threaded playback
+                arguments.reactor = true;
+                break;
+            case 't':
+                // Transpose channels
+                parse_assignments(optarg, store_transpose);
+                break;
+            case 'w':
+                // Render into a WAV file
+                arguments.render_path = std::string(optarg);
+                break;
+            case 'u':
+                // Drop duplicate notes
+                arguments.dedup = true;
+                break;
+            case OPT_ROUTE:
+                // Route channels to drive groups
+                parse_assignments(optarg, store_route);
+                break;
+            case OPT_MIN_LENGTH:
+                // Minimum note length
+                arguments.min_length = std::atoi(optarg);
+                break;
+            case OPT_MIN_VELOCITY:
+                // Minimum velocity
+                arguments.min_velocity = std::atoi(optarg);
+                break;
+            case OPT_METRICS:
+                // Live metrics
+                arguments.metrics = true;
+                break;
+            case OPT_WORKER:
+                // Worker for a coordinator
+                arguments.worker_port = std::atoi(optarg);
+                break;
+            case OPT_PLAYOUT_DELAY:
+                // Playout delay of the coordinator
+                arguments.playout_delay = std::atoi(optarg);
+                break;
+            case OPT_SHARDS:
+                // Number of drive shards
+                arguments.shards = std::atoi(optarg);
+                break;
+            case OPT_TEMPO:
+                // Playback speed
+                {
+                    double percent = std::atof(optarg);
+                    if (percent * 10 < MIN_SPEED || percent * 10 > MAX_SPEED)
+                    {
+                        std::cerr << "The tempo has to be between "
+                            << MIN_SPEED / 10 << " and " << MAX_SPEED / 10
+                            << " %" << std::endl;
+                        std::exit(1);
+                    }
+                    arguments.tempo = percent * 10 + 0.5;
+                }
+                break;
+            case OPT_CATCH_UP:
+                // Catch-up policy
+                if (!CatchUp::parse(optarg, arguments.catch_up))
+                {
+                    std::cerr << "Unknown catch-up policy '" << optarg
+                        << "'" << std::endl;
+                    std::exit(1);
+                }
+                break;
+            case OPT_STREAM:
+                // Song for a drive group
+                {
+                    std::string param(optarg);
+                    size_t eq = param.find('=');
+                    if (eq == std::string::npos || eq == 0
+                            || eq == param.size() - 1)
+                    {
+                        std::cerr << "--stream needs GROUP=MIDIFILE"
+                            << std::endl;
+                        std::exit(1);
+                    }
+                    std::string group = param.substr(0, eq);
+                    if (arguments.streams.count(group))
+                    {
+                        std::cerr << "Only one stream per drive group"
+                            << std::endl;
+                        std::exit(1);
+                    }
+                    arguments.streams[group] = param.substr(eq + 1);
+                }
+                break;
+            case OPT_HEAD_STATE:
+                // Head positions between runs
+                arguments.head_state = std::string(optarg);
+                break;
+            case OPT_LOOKAHEAD:
+                // Drive command lookahead
+                arguments.lookahead = std::atoi(optarg);
+                if (arguments.lookahead < 0 || arguments.lookahead > 1000)
+                {
+                    std::cerr << "The lookahead has to be between 0 and "
+                        "1000 ms" << std::endl;
+                    std::exit(1);
+                }
+                break;
+            case OPT_TRACE:
+                // Trace event file
+                arguments.trace_path = std::string(optarg);
+                break;
+            case OPT_TEMPO_KEYS:
+                // Tempo from the keyboard
+                arguments.tempo_keys = true;
+                break;
+            case OPT_BENCH_ENGINE:
+                // Drive engine benchmark
+                arguments.bench_engine = true;
+                break;
+            case OPT_BENCH_PARSE:
+                // MIDI decoder benchmark
+                arguments.bench_parse = true;
+                break;
+            case OPT_BENCH_IO:
+                // Output benchmark
+                arguments.bench_io = true;
+                break;
+            case OPT_LIVE:
+                // Live input instead of a file
+                arguments.live_path = std::string(optarg);
+                break;
             case 'm':
                 // Mute channels
                 {
@@ -137,6 +480,15 @@ void parse_args(int argc, char **argv)
         std::exit(0);
     }
 
+    if ((arguments.worker_port || !arguments.live_path.empty()
+                || arguments.bench_io || arguments.bench_engine
+                || !arguments.streams.empty()) && optind == argc)
+    {
+        // A worker gets its notes from the network, live input from
+        // the device, streams bring their own, the benchmark needs none
+        return;
+    }
+
     if (optind != argc - 1)
     {
         print_usage();
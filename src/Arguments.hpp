@@ -1,6 +1,8 @@
 #ifndef FM_ARGUMENTS_HPP
 #define FM_ARGUMENTS_HPP
 
+#include "CatchUp.hpp"
+#include <map>
 #include <set>
 #include <string>
 
@@ -11,6 +13,33 @@ struct Arguments
     std::string midi_path;
     std::set<int> mute_tracks;
     bool lyrics;
+    bool reactor;
+    std::map<int, int> transpose;
+    std::map<int, std::string> routes;
+    int min_length;
+    int min_velocity;
+    bool dedup;
+    bool metrics;
+    bool analyze;
+    std::string render_path;
+    int worker_port;
+    int playout_delay;
+    std::string live_path;
+    int shards;
+    bool bench_io;
+    bool bench_engine;
+    bool bench_parse;
+    // Playback speed in per mille
+    int tempo;
+    bool tempo_keys;
+    CatchUpPolicy catch_up;
+    // File to play, by drive group
+    std::map<std::string, std::string> streams;
+    std::string trace_path;
+    // Where the head positions are kept between runs, empty for none
+    std::string head_state;
+    // How far the drive commands are sent ahead, in ms
+    int lookahead;
 };
 
 extern Arguments arguments;
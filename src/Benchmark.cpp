@@ -0,0 +1,245 @@
+#include "Benchmark.hpp"
+#include "DriveManager.hpp"
+#include "GpioChipOutput.hpp"
+#include "GpioOutput.hpp"
+#include "MidiFile.hpp"
+#include "gpio.hpp"
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <time.h>
+#define BENCH_TICKS 20000
+// Ticks per engine for bench_engine(), about 14 s of playing
+#define ENGINE_TICKS 100000
+#define WARMUP_TICKS 1000
+// bench_parse() repeats for at least that long, in ns
+#define PARSE_NSEC 2000000000LL
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/* Step every drive in BENCH_TICKS ticks and print how long the ticks
+ * took
+ */
+static void bench_output(Output &output, DriveList const &drives,
+        char const *name, std::ostream &out)
+{
+    std::vector<Drive> bench;
+    for (DriveList::const_iterator drv = drives.begin();
+            drv != drives.end(); ++drv)
+    {
+        // No pulse width, that's just waiting
+        Drive d = {(int)bench.size(), drv->direction_pin, drv->stepper_pin,
+            0, -1, 0, true, 0, 0};
+        bench.push_back(d);
+        output.setup(d);
+    }
+    LatencyStats stats = {0, 0, 0, 0};
+    for (int tick = 0; tick < WARMUP_TICKS + BENCH_TICKS; ++tick)
+    {
+        long long start = now_nsec();
+        for (std::vector<Drive>::iterator d = bench.begin();
+                d != bench.end(); ++d)
+        {
+            output.step(*d);
+        }
+        output.flush();
+        long long took = now_nsec() - start;
+        if (tick < WARMUP_TICKS) continue;
+        if (!stats.count || took < stats.min) stats.min = took;
+        if (took > stats.max) stats.max = took;
+        stats.sum += took;
+        ++stats.count;
+    }
+    out << name << ": min " << stats.min << " ns, avg "
+        << stats.sum / stats.count << " ns, max " << stats.max
+        << " ns per tick" << std::endl;
+}
+
+
+bool bench_io(DriveList const &drives, std::string const &chip,
+        std::ostream &out)
+{
+    bool any = false;
+    out << "Stepping " << drives.size() << " drives " << BENCH_TICKS
+        << " times" << std::endl;
+    bool mmio_pins = true;
+    for (DriveList::const_iterator d = drives.begin(); d != drives.end(); ++d)
+    {
+        // Pins of the character device may be beyond the register
+        mmio_pins = mmio_pins && d->direction_pin < 32 && d->stepper_pin < 32;
+    }
+#ifdef NOGPIO
+    out << "MMIO: not built in (NOGPIO)" << std::endl;
+#else
+    if (mmio_pins && setup_io())
+    {
+        GpioOutput output;
+        bench_output(output, drives, "MMIO", out);
+        any = true;
+    }
+    else
+    {
+        out << "MMIO: unavailable" << std::endl;
+    }
+#endif
+    GpioChipOutput output(chip);
+    if (output.open(drives))
+    {
+        bench_output(output, drives, chip.c_str(), out);
+        any = true;
+    }
+    else
+    {
+        out << chip << ": unavailable" << std::endl;
+    }
+    return any;
+}
+
+
+/* Let every drive play a note of its own and time ENGINE_TICKS ticks.
+ * Returns the average ns per tick.
+ */
+static long long time_engine(DriveManager &dmgr, int drives)
+{
+    dmgr.setup(false);
+    for (int d = 0; d < drives; ++d)
+    {
+        // From A2 upwards, so the drives step in different ticks
+        dmgr.play(d, 110 * std::pow(2, d / 12.0));
+    }
+    long long start = now_nsec();
+    for (int tick = 0; tick < ENGINE_TICKS; ++tick)
+    {
+        dmgr.tick();
+    }
+    long long took = now_nsec() - start;
+    for (int d = 0; d < drives; ++d)
+    {
+        dmgr.stop(d);
+    }
+    return took / ENGINE_TICKS;
+}
+
+
+bool bench_engine(DriveList const &drives, std::ostream &out)
+{
+    if (!setup_io())
+    {
+        return false;
+    }
+    out << "Ticking " << drives.size() << " drives " << ENGINE_TICKS
+        << " times" << std::endl;
+    GpioOutput output;
+    DriveManager generic(drives, output);
+    out << "generic: " << time_engine(generic, drives.size())
+        << " ns per tick" << std::endl;
+    DriveManager fixed(drives, output);
+    if (!fixed.useFixedRig())
+    {
+#ifdef FIXED_RIG
+        out << "fixed: the drive configuration isn't the compiled rig"
+            << std::endl;
+#else
+        out << "fixed: not compiled in (make FIXED_RIG=...)" << std::endl;
+#endif
+        return true;
+    }
+    out << "fixed: " << time_engine(fixed, drives.size())
+        << " ns per tick" << std::endl;
+    return true;
+}
+
+
+/* Returns the MiB per second for size bytes every took ns */
+static double mib_per_sec(size_t size, long long took)
+{
+    return size / (1024.0 * 1024.0) / (took / 1e9);
+}
+
+
+bool bench_parse(std::string const &path, std::ostream &out)
+{
+    std::ifstream input(path.c_str(), std::ios::in | std::ios::binary);
+    if (!input.good())
+    {
+        std::cerr << "Can't open " << path << std::endl;
+        return false;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(input)),
+            std::istreambuf_iterator<char>());
+    unsigned char const *data =
+        reinterpret_cast<unsigned char const*>(bytes.data());
+    // The track chunks, without their headers
+    std::vector<size_t> starts, sizes;
+    size_t events = 0;
+    for (size_t pos = 0; pos + 8 <= bytes.size();)
+    {
+        size_t length = (size_t)data[pos + 4] << 24 | data[pos + 5] << 16
+            | data[pos + 6] << 8 | data[pos + 7];
+        if (length > bytes.size() - pos - 8) length = bytes.size() - pos - 8;
+        if (bytes.compare(pos, 4, "MTrk") == 0)
+        {
+            starts.push_back(pos + 8);
+            sizes.push_back(length);
+        }
+        pos += 8 + length;
+    }
+    {
+        std::istringstream check(bytes);
+        MidiFile midi;
+        if (!midi.read(check))
+        {
+            return false;
+        }
+        for (int t = 0; t < midi.getTrackCount(); ++t)
+        {
+            events += midi.getTrack(t)->size();
+        }
+    }
+    out << "Reading " << path << ": " << bytes.size() << " bytes, "
+        << starts.size() << " tracks, " << events << " events kept"
+        << std::endl;
+
+    std::ostringstream errors;
+    long long start = now_nsec();
+    long long took;
+    int runs = 0;
+    do
+    {
+        std::istringstream stream(bytes);
+        MidiFile midi;
+        midi.read(stream, errors);
+        ++runs;
+        took = now_nsec() - start;
+    }
+    while (took < PARSE_NSEC);
+    out << "read:   " << took / runs / 1000 << " us per file, "
+        << mib_per_sec(bytes.size(), took / runs) << " MiB/s" << std::endl;
+
+    start = now_nsec();
+    runs = 0;
+    do
+    {
+        for (size_t t = 0; t < starts.size(); ++t)
+        {
+            delete MidiTrack::from_buffer(t, data + starts[t], sizes[t],
+                    errors);
+        }
+        ++runs;
+        took = now_nsec() - start;
+    }
+    while (took < PARSE_NSEC);
+    out << "decode: " << took / runs / 1000 << " us per file, "
+        << mib_per_sec(bytes.size(), took / runs) << " MiB/s, "
+        << (long long)(events * 1e9 / (took / runs)) << " events/s"
+        << std::endl;
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef FM_BENCHMARK_HPP
+#define FM_BENCHMARK_HPP
+
+#include "DriveConfig.hpp"
+#include <ostream>
+#include <string>
+
+/* Measure what writing the pins of a tick costs with the memory mapped
+ * registers (GpioOutput) and with the GPIO character device chip
+ * (GpioChipOutput), stepping every drive in every tick. The pulse width
+ * is left out, only the writes count. Returns false if neither path
+ * could be used.
+ */
+bool bench_io(DriveList const &drives, std::string const &chip,
+        std::ostream &out);
+
+/* Compare how long a tick takes with the generic drive engine and with
+ * the one compiled for the rig (make FIXED_RIG=...), with every drive
+ * playing. Returns false if the GPIO registers can't be used.
+ */
+bool bench_engine(DriveList const &drives, std::ostream &out);
+
+/* Time reading the MIDI file at path from memory, as a whole
+ * (MidiFile::read()) and just decoding its track chunks
+ * (MidiTrack::from_buffer()). Returns false if the file can't be read
+ * or isn't valid.
+ */
+bool bench_parse(std::string const &path, std::ostream &out);
+
+#endif
@@ -0,0 +1,153 @@
+#include "CatchUp.hpp"
+#include "MidiEvents.hpp"
+#include <map>
+
+#define NEVER_SKIP -1
+#define NOT_A_NOTE -2
+
+
+/* Find the end of every note, the policies skip and resync need it */
+CatchUp::CatchUp(CatchUpPolicy policy, EventList const &events) :
+    m_policy(policy), m_offset(0), m_previous(0), m_moved(-1),
+    m_behind(false), m_ends(events.size(), NEVER_SKIP), m_late(0),
+    m_max_lateness(0), m_compressed(0), m_skipped(0), m_resyncs(0),
+    m_flushed(0)
+{
+    if (m_policy != CATCH_UP_SKIP && m_policy != CATCH_UP_RESYNC) return;
+    // Index of the note on that is open, by channel and note
+    std::map<int, size_t> open;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        if (events[i]->type() == Event_Note_On)
+        {
+            NoteOnEvent *e = dynamic_cast<NoteOnEvent*>(events[i]);
+            open[(e->getChannel() << 7) | e->getNote()] = i;
+        }
+        else if (events[i]->type() == Event_Note_Off)
+        {
+            NoteOffEvent *e = dynamic_cast<NoteOffEvent*>(events[i]);
+            std::map<int, size_t>::iterator on =
+                open.find((e->getChannel() << 7) | e->getNote());
+            if (on == open.end()) continue;
+            m_ends[on->second] = e->absolute_nsec;
+            open.erase(on);
+        }
+        else if (events[i]->type() == Event_Lyrics
+                || events[i]->type() == Event_Text)
+        {
+            m_ends[i] = NOT_A_NOTE;
+        }
+    }
+}
+
+
+/* Parse the name of a policy. Returns false if there is no such policy. */
+bool CatchUp::parse(std::string const &name, CatchUpPolicy &policy)
+{
+    char const *names[] = {"none", "compress", "skip", "resync"};
+    for (int p = CATCH_UP_NONE; p <= CATCH_UP_RESYNC; ++p)
+    {
+        if (name == names[p])
+        {
+            policy = (CatchUpPolicy)p;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/* Returns when to play an event that is due (without any lateness)
+ * at due
+ */
+long long CatchUp::deadline(long long due)
+{
+    if (m_policy == CATCH_UP_COMPRESS && m_offset > 0)
+    {
+        // Half of the gap to the previous event goes to catching up
+        m_offset -= (due - m_previous) / 2;
+        if (m_offset < 0) m_offset = 0;
+        ++m_compressed;
+    }
+    m_previous = due;
+    return due + m_offset;
+}
+
+
+/* Whether to leave out the event, because it's a note that is over
+ * already (skip and resync) or a late lyric (resync). deadline is what
+ * deadline() returned for it.
+ */
+bool CatchUp::skip(size_t event, long long deadline, long long now,
+        SongClock &clock)
+{
+    bool late = now - deadline > LATE_NSEC;
+    if (m_policy == CATCH_UP_RESYNC)
+    {
+        if (late && !m_behind) ++m_resyncs;
+        m_behind = late;
+        if (!late || m_ends[event] == NEVER_SKIP
+                || (m_ends[event] >= 0 && clock.wallTime(m_ends[event]) > now))
+        {
+            // A note that still sounds starts now
+            return false;
+        }
+        ++m_flushed;
+        return true;
+    }
+    if (m_policy != CATCH_UP_SKIP || m_ends[event] < 0 || !late
+            || clock.wallTime(m_ends[event]) > now)
+    {
+        return false;
+    }
+    ++m_skipped;
+    return true;
+}
+
+
+/* The event for deadline has been played at now */
+void CatchUp::played(long long deadline, long long now)
+{
+    long long lateness = now - deadline;
+    if (lateness <= LATE_NSEC) return;
+    ++m_late;
+    if (lateness > m_max_lateness) m_max_lateness = lateness;
+    if (m_policy != CATCH_UP_COMPRESS)
+    {
+        return;
+    }
+    if (deadline == m_moved)
+    {
+        // The other events of a chord, the song is moved back already
+        return;
+    }
+    m_moved = deadline;
+    m_offset += lateness;
+}
+
+
+void CatchUp::report(std::ostream &out) const
+{
+    out << "Late events: " << m_late;
+    if (m_late)
+    {
+        out << " (up to " << m_max_lateness / 1000000 << " ms)";
+    }
+    out << std::endl;
+    switch (m_policy)
+    {
+        case CATCH_UP_COMPRESS:
+            out << "Events played with a shorter gap: " << m_compressed
+                << std::endl;
+            break;
+        case CATCH_UP_SKIP:
+            out << "Notes skipped: " << m_skipped << std::endl;
+            break;
+        case CATCH_UP_RESYNC:
+            out << "Resyncs: " << m_resyncs << ", events left out: "
+                << m_flushed << std::endl;
+            break;
+        default:
+            break;
+    }
+}
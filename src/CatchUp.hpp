@@ -0,0 +1,72 @@
+#ifndef FM_CATCH_UP_HPP
+#define FM_CATCH_UP_HPP
+
+#include "MidiTrack.hpp"
+#include "SongClock.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* What the play loop does when it fell behind, e.g. because it was
+ * preempted:
+ * none     plays the events that are due right away, one after another
+ * compress halves the gaps between the following events until it is
+ *          back on schedule
+ * skip     like none, but drops the notes that would already be over
+ *          (their note off is due as well), instead of a pointless
+ *          play/stop pair
+ * resync   jumps back onto the timeline: of the events that are past
+ *          only the note offs and the notes that still sound are
+ *          played, everything else is left out, so the rest of the
+ *          song plays on time
+ */
+enum CatchUpPolicy
+{
+    CATCH_UP_NONE,
+    CATCH_UP_COMPRESS,
+    CATCH_UP_SKIP,
+    CATCH_UP_RESYNC
+};
+
+// Events later than this (ns) count as late, below it's just jitter
+#define LATE_NSEC 2000000
+
+/* Tracks how late the events of a song are played and applies the
+ * catch-up policy. The play loop asks deadline() when an event is due,
+ * skip() whether to play it after all and reports with played() when
+ * it did.
+ */
+class CatchUp
+{
+    private:
+    CatchUpPolicy m_policy;
+    // How far the song is behind (compress)
+    long long m_offset;
+    long long m_previous;
+    // The deadline the song was last moved back for
+    long long m_moved;
+    // The last event was late (resync)
+    bool m_behind;
+    // Song time of the end of the note, by event. NEVER_SKIP for note
+    // offs and the like, NOT_A_NOTE for lyrics and text.
+    std::vector<long long> m_ends;
+    long long m_late;
+    long long m_max_lateness;
+    long long m_compressed;
+    long long m_skipped;
+    long long m_resyncs;
+    long long m_flushed;
+
+    public:
+    CatchUp(CatchUpPolicy policy, EventList const &events);
+
+    static bool parse(std::string const &name, CatchUpPolicy &policy);
+
+    long long deadline(long long due);
+    bool skip(size_t event, long long deadline, long long now,
+            SongClock &clock);
+    void played(long long deadline, long long now);
+    void report(std::ostream &out) const;
+};
+
+#endif
@@ -0,0 +1,341 @@
+#include "Cluster.hpp"
+#include "Protocol.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of exchanges for the first clock offset estimate and for the
+// ones during playback
+#define SYNC_SAMPLES 16
+#define RESYNC_SAMPLES 4
+#define RESYNC_INTERVAL 5000000000LL
+// How long to wait for a reply, in milliseconds
+#define SYNC_TIMEOUT 200
+#define SYNC_TIMEOUT_NSEC (SYNC_TIMEOUT * 1000000LL)
+// How often the state of every drive is sent again
+#define REFRESH_INTERVAL 1000000000LL
+
+
+/* remotes are the workers from the drive configuration, drives the
+ * drive list (where every drive is a remote one). playout_delay is in
+ * nanoseconds.
+ */
+Cluster::Cluster(std::vector<RemoteWorker> const &remotes,
+        DriveList const &drives, long long playout_delay) :
+    m_socket(-1), m_remotes(remotes), m_playout_delay(playout_delay),
+    m_due(0), m_last_sync(0), m_last_refresh(0),
+    m_state(drives.size(), 0), m_seq(0)
+{
+    for (DriveList::const_iterator d = drives.begin();
+            d != drives.end(); ++d)
+    {
+        m_drive_node.push_back(d->remote);
+    }
+}
+
+
+Cluster::~Cluster()
+{
+    if (m_socket >= 0)
+    {
+        close(m_socket);
+    }
+}
+
+
+/* Resolve the workers and estimate their clock offsets. Returns false
+ * if a worker can't be reached.
+ */
+bool Cluster::connect()
+{
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket < 0)
+    {
+        std::cerr << "Cluster: Can't create socket: " << std::strerror(errno)
+            << std::endl;
+        return false;
+    }
+    int first_drive = 0;
+    for (std::vector<RemoteWorker>::const_iterator r = m_remotes.begin();
+            r != m_remotes.end(); ++r)
+    {
+        addrinfo hints, *result;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        std::stringstream port;
+        port << r->port;
+        int err = getaddrinfo(r->host.c_str(), port.str().c_str(), &hints,
+                &result);
+        if (err != 0)
+        {
+            std::cerr << "Cluster: Can't resolve " << r->host << ": "
+                << gai_strerror(err) << std::endl;
+            return false;
+        }
+        Node node;
+        std::memcpy(&node.addr, result->ai_addr, sizeof(node.addr));
+        freeaddrinfo(result);
+        node.first_drive = first_drive;
+        node.probing = false;
+        node.probes_left = 0;
+        first_drive += r->drives;
+        if (!sync(node, SYNC_SAMPLES))
+        {
+            std::cerr << "Cluster: No answer from worker " << r->host << ":"
+                << r->port << std::endl;
+            return false;
+        }
+        std::cout << "Worker " << r->host << ":" << r->port << ": offset "
+            << node.offset / 1000 << " us, round trip "
+            << node.delay / 1000 << " us" << std::endl;
+        if (node.delay > m_playout_delay)
+        {
+            std::cerr << "Cluster: Warning, the round trip to " << r->host
+                << " is longer than the playout delay" << std::endl;
+        }
+        m_nodes.push_back(node);
+    }
+    m_last_sync = monotonic_nsec();
+    return true;
+}
+
+
+void Cluster::send(Node const &node, int type, int drive, long long a,
+        long long b)
+{
+    Packet packet = {type, drive, ++m_seq, a, b, 0};
+    unsigned char buffer[PACKET_SIZE];
+    encode_packet(packet, buffer);
+    sendto(m_socket, buffer, PACKET_SIZE, 0, (sockaddr const*)&node.addr,
+            sizeof(node.addr));
+}
+
+
+/* Estimate the clock offset and round trip time of a node. Uses the
+ * exchange with the smallest round trip of the given number of
+ * samples, since that's the one least disturbed by queueing. Returns
+ * false if there was no reply at all.
+ */
+bool Cluster::sync(Node &node, int samples)
+{
+    bool found = false;
+    unsigned char buffer[PACKET_SIZE];
+    Packet reply;
+    for (int i = 0; i < samples; ++i)
+    {
+        long long t0 = monotonic_nsec();
+        send(node, PACKET_SYNC, 0, t0, 0);
+        pollfd pfd = {m_socket, POLLIN, 0};
+        while (poll(&pfd, 1, SYNC_TIMEOUT) > 0)
+        {
+            if (recv(m_socket, buffer, PACKET_SIZE, 0) != PACKET_SIZE)
+            {
+                continue;
+            }
+            long long t3 = monotonic_nsec();
+            decode_packet(buffer, reply);
+            if (reply.type != PACKET_SYNC_REPLY || reply.seq != m_seq)
+            {
+                // Old or foreign reply
+                continue;
+            }
+            long long delay = (t3 - t0) - (reply.c - reply.b);
+            if (!found || delay < node.delay)
+            {
+                node.delay = delay;
+                node.offset = ((reply.b - t0) + (reply.c - t3)) / 2;
+                found = true;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+
+/* Send the next resync probe to a node, or take the best exchange of
+ * the resync if all probes are done
+ */
+void Cluster::probe(Node &node, long long now)
+{
+    if (node.probes_left > 0)
+    {
+        send(node, PACKET_SYNC, 0, now, 0);
+        node.probing = true;
+        node.probe = m_seq;
+        node.probe_sent = now;
+        --node.probes_left;
+        return;
+    }
+    node.probing = false;
+    if (node.sampled)
+    {
+        node.offset = node.sample_offset;
+        node.delay = node.sample_delay;
+    }
+}
+
+
+/* Read the replies to the resync probes that have arrived */
+void Cluster::receive()
+{
+    unsigned char buffer[PACKET_SIZE];
+    Packet reply;
+    while (recv(m_socket, buffer, PACKET_SIZE, MSG_DONTWAIT) == PACKET_SIZE)
+    {
+        long long t3 = monotonic_nsec();
+        decode_packet(buffer, reply);
+        if (reply.type != PACKET_SYNC_REPLY) continue;
+        for (std::vector<Node>::iterator n = m_nodes.begin();
+                n != m_nodes.end(); ++n)
+        {
+            if (!n->probing || n->probe != reply.seq) continue;
+            // Replies that came in while we were busy with an event
+            // look slow, the smallest round trip sorts them out
+            long long delay = (t3 - reply.a) - (reply.c - reply.b);
+            if (!n->sampled || delay < n->sample_delay)
+            {
+                n->sample_delay = delay;
+                n->sample_offset = ((reply.b - reply.a) + (reply.c - t3)) / 2;
+                n->sampled = true;
+            }
+            probe(*n, t3);
+            break;
+        }
+    }
+}
+
+
+/* Send the state of every drive again, due after everything that has
+ * been sent already
+ */
+void Cluster::refresh(long long now)
+{
+    long long due = now + m_playout_delay;
+    if (due < m_due) due = m_due;
+    for (size_t d = 0; d < m_state.size(); ++d)
+    {
+        Node const &node = m_nodes[m_drive_node[d]];
+        send(node, PACKET_STATE, d - node.first_drive, due + node.offset,
+                m_state[d]);
+    }
+    m_last_refresh = now;
+}
+
+
+/* Start resyncs, refreshes and the next probes that are due. Returns
+ * when it has to be called again.
+ */
+long long Cluster::maintain(long long now)
+{
+    // Clocks drift apart, so keep the offsets up to date
+    if (now - m_last_sync >= RESYNC_INTERVAL)
+    {
+        for (std::vector<Node>::iterator n = m_nodes.begin();
+                n != m_nodes.end(); ++n)
+        {
+            if (n->probing) continue;
+            n->probes_left = RESYNC_SAMPLES;
+            n->sampled = false;
+            probe(*n, now);
+        }
+        m_last_sync = now;
+    }
+    if (now - m_last_refresh >= REFRESH_INTERVAL)
+    {
+        refresh(now);
+    }
+    long long next = m_last_sync + RESYNC_INTERVAL;
+    if (m_last_refresh + REFRESH_INTERVAL < next)
+    {
+        next = m_last_refresh + REFRESH_INTERVAL;
+    }
+    for (std::vector<Node>::iterator n = m_nodes.begin();
+            n != m_nodes.end(); ++n)
+    {
+        if (n->probing && now - n->probe_sent >= SYNC_TIMEOUT_NSEC)
+        {
+            // Lost, go on with the next one
+            probe(*n, now);
+        }
+        if (n->probing && n->probe_sent + SYNC_TIMEOUT_NSEC < next)
+        {
+            next = n->probe_sent + SYNC_TIMEOUT_NSEC;
+        }
+    }
+    return next;
+}
+
+
+/* Sleep until deadline, doing the resyncs and refreshes meanwhile */
+void Cluster::wait(long long deadline)
+{
+    pollfd pfd = {m_socket, POLLIN, 0};
+    timespec timeout;
+    for (;;)
+    {
+        long long now = monotonic_nsec();
+        long long until = maintain(now);
+        if (now >= deadline) return;
+        if (deadline < until) until = deadline;
+        timeout.tv_sec = (until - now) / 1000000000LL;
+        timeout.tv_nsec = (until - now) % 1000000000LL;
+        if (ppoll(&pfd, 1, &timeout, NULL) > 0)
+        {
+            receive();
+        }
+    }
+}
+
+
+/* Play the given event list. The Player has to use this Cluster for
+ * its drives.
+ */
+void Cluster::run(EventList &events, Player &player, SongClock &clock)
+{
+    clock.start(monotonic_nsec());
+    m_last_refresh = monotonic_nsec();
+    long long deadline;
+    for (EventList::iterator event = events.begin();
+            event != events.end(); ++event)
+    {
+        deadline = clock.wallTime((*event)->absolute_nsec);
+        wait(deadline);
+        m_due = deadline + m_playout_delay;
+        player.handle(*event);
+    }
+    for (std::vector<Node>::iterator n = m_nodes.begin();
+            n != m_nodes.end(); ++n)
+    {
+        send(*n, PACKET_BYE, 0, m_due + n->offset, 0);
+    }
+}
+
+
+/* Send a command for the current event to the worker of the drive */
+void Cluster::command(int drive, long long frequency)
+{
+    Node const &node = m_nodes[m_drive_node[drive]];
+    m_state[drive] = frequency;
+    send(node, PACKET_COMMAND, drive - node.first_drive,
+            m_due + node.offset, frequency);
+}
+
+
+void Cluster::play(int drive, double frequency)
+{
+    command(drive, frequency * 1000);
+}
+
+
+void Cluster::stop(int drive)
+{
+    command(drive, 0);
+}
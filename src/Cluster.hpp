@@ -0,0 +1,84 @@
+#ifndef FM_CLUSTER_HPP
+#define FM_CLUSTER_HPP
+
+#include "DriveConfig.hpp"
+#include "DriveControl.hpp"
+#include "MidiTrack.hpp"
+#include "Player.hpp"
+#include "SongClock.hpp"
+#include <netinet/in.h>
+#include <vector>
+
+/* The coordinator side of a distributed rig. All drives are owned by
+ * workers (floppymusic --worker) on other hosts, the Cluster sends them
+ * timestamped commands over UDP (see Protocol.hpp).
+ *
+ * For every worker the offset between its clock and ours is estimated
+ * like NTP does: of several request/reply exchanges the one with the
+ * smallest round trip is used. Commands are due playout delay after
+ * the event they belong to, which gives the packets time to arrive and
+ * makes every worker play in sync.
+ *
+ * During playback the offsets are measured again now and then. The
+ * probes are sent one after another while waiting for the next event,
+ * so a lost reply never holds up the commands. The state of every drive
+ * is repeated every second (see PACKET_STATE), since there are no
+ * acknowledgements.
+ */
+class Cluster : public DriveControl
+{
+    private:
+    struct Node
+    {
+        sockaddr_in addr;
+        long long offset;
+        long long delay;
+        int first_drive;
+        // The resync in progress: the probe waiting for its reply, how
+        // many are still to be sent and the best exchange so far
+        bool probing;
+        unsigned int probe;
+        long long probe_sent;
+        int probes_left;
+        bool sampled;
+        long long sample_offset;
+        long long sample_delay;
+    };
+
+    int m_socket;
+    std::vector<RemoteWorker> m_remotes;
+    std::vector<Node> m_nodes;
+    std::vector<int> m_drive_node;
+    long long m_playout_delay;
+    long long m_due;
+    long long m_last_sync;
+    long long m_last_refresh;
+    // What every drive plays in mHz, 0 if it's silent
+    std::vector<long long> m_state;
+    unsigned int m_seq;
+
+    Cluster(Cluster const &other);
+    Cluster& operator=(Cluster const &other);
+
+    bool sync(Node &node, int samples);
+    void send(Node const &node, int type, int drive, long long a, long long b);
+    void command(int drive, long long frequency);
+    void wait(long long deadline);
+    long long maintain(long long now);
+    void probe(Node &node, long long now);
+    void receive();
+    void refresh(long long now);
+
+    public:
+    Cluster(std::vector<RemoteWorker> const &remotes, DriveList const &drives,
+            long long playout_delay);
+    ~Cluster();
+
+    bool connect();
+    void run(EventList &events, Player &player, SongClock &clock);
+
+    virtual void play(int drive, double frequency);
+    virtual void stop(int drive);
+};
+
+#endif
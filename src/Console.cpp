@@ -0,0 +1,194 @@
+#include "Console.hpp"
+#include "Trace.hpp"
+#include <cstdio>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEC_IN_NSEC (1000000000LL)
+// Nice value of the logger thread
+#define LOGGER_NICE 10
+// Bytes the logger writes at once
+#define CONSOLE_BUFFER_SIZE 4096
+
+struct ConsoleEntry
+{
+    long long time;
+    bool line;
+    char const *text;
+};
+
+static ConsoleEntry ring[CONSOLE_RING_SIZE];
+// Written by the play thread only
+static unsigned int head = 0;
+// Written by the logger thread only
+static unsigned int tail = 0;
+static unsigned long dropped = 0;
+static long long epoch;
+// Whether the last thing printed was a newline, only used by the logger
+static bool line_start = true;
+static bool running = false;
+static volatile bool stopping = false;
+static sem_t pending;
+static pthread_t logger;
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * SEC_IN_NSEC + t.tv_nsec;
+}
+
+
+// What the logger is about to write, flushed whenever it's full
+static char out[CONSOLE_BUFFER_SIZE];
+static size_t out_len = 0;
+
+
+static void flush_out()
+{
+    if (!out_len) return;
+    std::fwrite(out, 1, out_len, stdout);
+    out_len = 0;
+}
+
+
+static void append(char const *text)
+{
+    for (; *text; ++text)
+    {
+        if (out_len == sizeof(out)) flush_out();
+        out[out_len++] = *text;
+    }
+}
+
+
+static void format(ConsoleEntry const &entry)
+{
+    if (!entry.line)
+    {
+        append(entry.text);
+        if (out_len) line_start = out[out_len - 1] == '\n';
+        return;
+    }
+    if (!line_start)
+    {
+        // Lines don't go into the middle of the lyrics
+        append("\n");
+    }
+    line_start = true;
+    long long msec = (entry.time - epoch) / 1000000;
+    char stamp[32];
+    std::snprintf(stamp, sizeof(stamp), "[%lld:%02lld.%03lld] ",
+            msec / 60000, msec / 1000 % 60, msec % 1000);
+    append(stamp);
+    append(entry.text);
+    append("\n");
+}
+
+
+/* Print everything that's in the ring with as few writes as possible, so
+ * a logger that fell behind catches up at once. It doesn't allocate, the
+ * text goes through a fixed buffer.
+ */
+static void drain()
+{
+    unsigned int h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (h == tail) return;
+    for (unsigned int t = tail; t != h; ++t)
+    {
+        format(ring[t % CONSOLE_RING_SIZE]);
+    }
+    __atomic_store_n(&tail, h, __ATOMIC_RELEASE);
+    flush_out();
+    std::fflush(stdout);
+}
+
+
+static void *logger_loop(void *)
+{
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), LOGGER_NICE);
+    TRACE_THREAD("console");
+    while (!stopping)
+    {
+        sem_wait(&pending);
+        drain();
+    }
+    drain();
+    return NULL;
+}
+
+
+/* Start the logger thread. Everything that is printed to stdout by the
+ * other threads from now on may come in between.
+ */
+void console_start()
+{
+    if (running) return;
+    std::fflush(stdout);
+    epoch = now_nsec();
+    sem_init(&pending, 0, 0);
+    stopping = false;
+    running = pthread_create(&logger, NULL, logger_loop, NULL) == 0;
+}
+
+
+/* Print what's left and stop the logger thread */
+void console_stop()
+{
+    if (!running) return;
+    stopping = true;
+    sem_post(&pending);
+    pthread_join(logger, NULL);
+    sem_destroy(&pending);
+    running = false;
+    if (!line_start)
+    {
+        std::fputc('\n', stdout);
+        line_start = true;
+    }
+    if (dropped)
+    {
+        std::printf("\n%lu console messages dropped\n", dropped);
+    }
+}
+
+
+static void push(char const *text, bool line)
+{
+    if (!running)
+    {
+        std::fputs(text, stdout);
+        if (line) std::fputc('\n', stdout);
+        std::fflush(stdout);
+        return;
+    }
+    unsigned int h = head;
+    if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= CONSOLE_RING_SIZE)
+    {
+        ++dropped;
+        return;
+    }
+    ConsoleEntry &entry = ring[h % CONSOLE_RING_SIZE];
+    entry.time = now_nsec();
+    entry.line = line;
+    entry.text = text;
+    __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+    sem_post(&pending);
+}
+
+
+void console_text(char const *text)
+{
+    push(text, false);
+}
+
+
+void console_line(char const *text)
+{
+    push(text, true);
+}
@@ -0,0 +1,28 @@
+#ifndef FM_CONSOLE_HPP
+#define FM_CONSOLE_HPP
+
+/* Console output during playback. Writing to a terminal can block for a
+ * long time (think of a slow SSH session), so the play thread only puts
+ * a pointer to the text and the time into a preallocated ring and a
+ * logger thread with a low priority does the actual printing. Nothing
+ * in here allocates or blocks on the side of the play thread; if the
+ * ring is full the text is dropped and counted.
+ *
+ * The text isn't copied, it has to stay around until console_stop(),
+ * which is the case for the text of the MIDI events. There is only one
+ * writer, the thread that plays the events.
+ *
+ * Without console_start() everything is printed right away.
+ */
+
+#define CONSOLE_RING_SIZE 256
+
+void console_start();
+void console_stop();
+
+// Text as it is, like lyrics
+void console_text(char const *text);
+// A line of its own, prefixed with the time since console_start()
+void console_line(char const *text);
+
+#endif
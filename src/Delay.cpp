@@ -0,0 +1,76 @@
+#include "Delay.hpp"
+#include <time.h>
+
+#define SEC_IN_NSEC (1000000000LL)
+// Delays from this long on spin on the clock, a clock_gettime() is
+// cheap enough compared to them
+#define CLOCK_SPIN_NSEC 2000
+#define CALIBRATION_LOOPS 200000
+#define CALIBRATION_RUNS 5
+
+static double loops_per_nsec = 0;
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * SEC_IN_NSEC + t.tv_nsec;
+}
+
+
+static void spin(unsigned long loops)
+{
+    for (unsigned long i = loops; i > 0; --i)
+    {
+        // Keeps the compiler from removing the loop
+        asm volatile("" ::: "memory");
+    }
+}
+
+
+/* Measure the speed of the delay loop. Takes a few dozen milliseconds
+ * the first time, later calls do nothing.
+ */
+void calibrate_delay()
+{
+    if (loops_per_nsec > 0) return;
+    // Give the CPU governor a moment to go up to full speed
+    long long warmup_end = now_nsec() + 50000000LL;
+    while (now_nsec() < warmup_end)
+        ;
+    long long best = -1;
+    for (int run = 0; run < CALIBRATION_RUNS; ++run)
+    {
+        long long start = now_nsec();
+        spin(CALIBRATION_LOOPS);
+        long long took = now_nsec() - start;
+        // The fastest run is the one nobody interrupted
+        if (best == -1 || took < best)
+        {
+            best = took;
+        }
+    }
+    loops_per_nsec = (double)CALIBRATION_LOOPS / (best > 0 ? best : 1);
+}
+
+
+/* Busy wait for nsec nanoseconds */
+void delay_nsec(int nsec)
+{
+    if (nsec <= 0) return;
+    if (nsec >= CLOCK_SPIN_NSEC)
+    {
+        long long end = now_nsec() + nsec;
+        while (now_nsec() < end)
+            ;
+        return;
+    }
+    spin((unsigned long)(nsec * loops_per_nsec));
+}
+
+
+double delay_loops_per_usec()
+{
+    return loops_per_nsec * 1000;
+}
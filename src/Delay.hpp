@@ -0,0 +1,15 @@
+#ifndef FM_DELAY_HPP
+#define FM_DELAY_HPP
+
+/* Busy waiting for short delays like the width of a step pulse, far too
+ * short for any kind of sleep. calibrate_delay() measures once how fast
+ * an empty loop runs on this CPU, delay_nsec() then spins for the
+ * matching number of iterations. Longer delays spin on the monotonic
+ * clock instead, which doesn't care about CPU frequency changes.
+ */
+
+void calibrate_delay();
+void delay_nsec(int nsec);
+double delay_loops_per_usec();
+
+#endif
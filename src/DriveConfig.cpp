@@ -1,16 +1,35 @@
 #include "DriveConfig.hpp"
+#include "Protocol.hpp"
+#include "Trace.hpp"
 #include <iostream>
+#include <set>
 #include <string>
 #include <sstream>
 
 #define COMMENT_CHAR '#'
 #define WHITESPACE " \t"
+// C4 to B4, the octave floppymusic always played in
+#define DEFAULT_LOW_NOTE 60
+#define DEFAULT_HIGH_NOTE 71
+// Step pulse width in ns, about what the old nop loop took on a Pi 1
+#define DEFAULT_PULSE 250
+// Longer pulses would eat into the 139 us of a tick
+#define MAX_PULSE 50000
+#define MAX_SHARDS 64
+// GPIO pins go into a 32 bit register
+#define MAX_GPIO_PIN 31
+// The character device has no such limit, but the Pi 5 has 54 lines
+#define MAX_CHIP_LINE 1023
+#define MAX_SPI_REGISTERS 64
+#define DEFAULT_SPI_SPEED 4000000
 
-DriveConfig::DriveConfig()
+DriveConfig::DriveConfig() :
+    m_uses_spi(false), m_valid(false)
 {}
 
 
-DriveConfig::DriveConfig(std::istream &inp)
+DriveConfig::DriveConfig(std::istream &inp) :
+    m_uses_spi(false)
 {
     m_valid = this->read(inp);
 }
@@ -68,7 +87,133 @@ static void trim(std::string &what)
 }
 
 
-#define PINMASK(x) (1 << x)
+/* Parse a single key=value option of a drive line. Returns false if the
+ * option is unknown or invalid.
+ */
+bool DriveConfig::readOption(ConnectedDrive &cdrive, std::string const &option)
+{
+    size_t eq = option.find('=');
+    if (eq == std::string::npos)
+    {
+        return false;
+    }
+    std::string key = option.substr(0, eq);
+    std::string value = option.substr(eq + 1);
+    if (key == "group" && value.length() > 0)
+    {
+        cdrive.group = groupIndex(value);
+        if (cdrive.group == -1)
+        {
+            cdrive.group = m_groups.size();
+            m_groups.push_back(value);
+        }
+        return true;
+    }
+    else if (key == "range")
+    {
+        std::vector<std::string> bounds = split(value, "-");
+        if (bounds.size() != 2) return false;
+        cdrive.low_note = str_to_int(bounds[0]);
+        cdrive.high_note = str_to_int(bounds[1]);
+        return cdrive.low_note >= 0 && cdrive.high_note <= 127
+            && cdrive.low_note <= cdrive.high_note;
+    }
+    else if (key == "pan")
+    {
+        std::stringstream ss(value);
+        ss >> cdrive.pan;
+        return !ss.fail() && cdrive.pan >= -1 && cdrive.pan <= 1;
+    }
+    else if (key == "pulse")
+    {
+        std::stringstream ss(value);
+        ss >> cdrive.pulse;
+        return !ss.fail() && cdrive.pulse >= 0 && cdrive.pulse <= MAX_PULSE;
+    }
+    else if (key == "shard")
+    {
+        std::stringstream ss(value);
+        ss >> cdrive.shard;
+        return !ss.fail() && cdrive.shard >= 0 && cdrive.shard < MAX_SHARDS;
+    }
+    return false;
+}
+
+
+/* Parse the spi line: spi DEVICE [speed=HZ] [registers=N]. Returns false
+ * if it is invalid.
+ */
+bool DriveConfig::readSpi(std::vector<std::string> const &line)
+{
+    if (line.size() < 2 || m_uses_spi || !m_chip.empty() || !m_drives.empty())
+    {
+        return false;
+    }
+    m_uses_spi = true;
+    m_spi.device = line[1];
+    m_spi.speed = DEFAULT_SPI_SPEED;
+    // Unless given, as many as the drives need
+    m_spi.registers = 0;
+    for (size_t opt = 2; opt < line.size(); ++opt)
+    {
+        size_t eq = line[opt].find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = line[opt].substr(0, eq);
+        int value = str_to_int(line[opt].substr(eq + 1));
+        if (key == "speed" && value > 0)
+        {
+            m_spi.speed = value;
+        }
+        else if (key == "registers" && value > 0 && value <= MAX_SPI_REGISTERS)
+        {
+            m_spi.registers = value;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/* Parse the gpiochip line: gpiochip DEVICE. Returns false if it is
+ * invalid.
+ */
+bool DriveConfig::readChip(std::vector<std::string> const &line)
+{
+    if (line.size() != 2 || m_uses_spi || !m_chip.empty() || !m_drives.empty())
+    {
+        return false;
+    }
+    m_chip = line[1];
+    return true;
+}
+
+
+/* Parse a pin of a drive line. That's the GPIO number, or with shift
+ * registers register.bit. Returns false if it is invalid.
+ */
+bool DriveConfig::readPin(std::string const &field, int &pin) const
+{
+    if (!m_uses_spi)
+    {
+        std::stringstream ss(field);
+        ss >> pin;
+        int max = m_chip.empty() ? MAX_GPIO_PIN : MAX_CHIP_LINE;
+        return !ss.fail() && ss.eof() && pin >= 0 && pin <= max;
+    }
+    std::vector<std::string> parts = split(field, ".");
+    if (parts.size() != 2) return false;
+    int reg = str_to_int(parts[0]);
+    int bit = str_to_int(parts[1]);
+    int registers = m_spi.registers ? m_spi.registers : MAX_SPI_REGISTERS;
+    if (reg < 0 || reg >= registers || bit < 0 || bit > 7) return false;
+    pin = reg * 8 + bit;
+    return true;
+}
+
+
 /* Read and parse the given drive config from the given input stream.
  * Returns if the file was valid.
  * This is a private method and only called by the constructor that
@@ -76,9 +221,10 @@ static void trim(std::string &what)
  */
 bool DriveConfig::read(std::istream &inp)
 {
+    TRACE_SCOPE("read drive config");
     std::string line;
     int lineno = 0;
-    unsigned int pins = 0;
+    std::set<int> pins;
     std::vector<std::string> splitted;
     ConnectedDrive cdrive;
     size_t pos;
@@ -95,33 +241,127 @@ bool DriveConfig::read(std::istream &inp)
             continue;
         }
         splitted = split(line, " ");
-        if (splitted.size() != 3)
+        if (splitted[0] == "spi")
+        {
+            if (!readSpi(splitted))
+            {
+                std::cerr << "DriveConfig: Invalid spi line '" << line
+                    << "' (line " << lineno << "), it has to come before "
+                    "the drives" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (splitted[0] == "gpiochip")
+        {
+            if (!readChip(splitted))
+            {
+                std::cerr << "DriveConfig: Invalid gpiochip line '" << line
+                    << "' (line " << lineno << "), it has to come before "
+                    "the drives" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        size_t first_option = (splitted[0] == "remote") ? 4 : 3;
+        if (splitted.size() < first_option)
         {
             std::cerr << "DriveConfig: Invalid line '" << line << "' ("
                 << lineno << ")" << std::endl;
             return false;
         }
-        if (splitted[0] != "drive")
+        if (splitted[0] != "drive" && splitted[0] != "remote")
         {
             std::cerr << "DriveConfig: Invalid command " << splitted[0]
                 << std::endl;
             return false;
         }
-        cdrive.direction_pin = str_to_int(splitted[1]);
-        cdrive.stepper_pin = str_to_int(splitted[2]);
-        if ((pins & PINMASK(cdrive.direction_pin))
-                || (pins & PINMASK(cdrive.stepper_pin)))
+        cdrive.direction_pin = -1;
+        cdrive.stepper_pin = -1;
+        cdrive.group = -1;
+        cdrive.low_note = DEFAULT_LOW_NOTE;
+        cdrive.high_note = DEFAULT_HIGH_NOTE;
+        cdrive.pan = PAN_AUTO;
+        cdrive.remote = -1;
+        cdrive.pulse = DEFAULT_PULSE;
+        cdrive.shard = -1;
+        for (size_t opt = first_option; opt < splitted.size(); ++opt)
+        {
+            if (!readOption(cdrive, splitted[opt]))
+            {
+                std::cerr << "DriveConfig: Invalid option '" << splitted[opt]
+                    << "' (line " << lineno << ")" << std::endl;
+                return false;
+            }
+        }
+
+        if (splitted[0] == "remote")
+        {
+            // Drives of a worker on another host, they all share the
+            // options of the line
+            RemoteWorker worker;
+            worker.host = splitted[1];
+            worker.port = str_to_int(splitted[2]);
+            worker.drives = str_to_int(splitted[3]);
+            if (worker.port <= 0 || worker.port > 65535 || worker.drives <= 0)
+            {
+                std::cerr << "DriveConfig: Invalid remote '" << line
+                    << "' (line " << lineno << ")" << std::endl;
+                return false;
+            }
+            if (worker.drives > PACKET_MAX_DRIVES)
+            {
+                std::cerr << "DriveConfig: A worker can't have more than "
+                    << PACKET_MAX_DRIVES << " drives (line " << lineno << ")"
+                    << std::endl;
+                return false;
+            }
+            cdrive.remote = m_remotes.size();
+            m_remotes.push_back(worker);
+            for (int i = 0; i < worker.drives; ++i)
+            {
+                m_drives.push_back(cdrive);
+            }
+            continue;
+        }
+
+        if (!readPin(splitted[1], cdrive.direction_pin)
+                || !readPin(splitted[2], cdrive.stepper_pin))
+        {
+            std::cerr << "DriveConfig: Invalid pin (line " << lineno << ")"
+                << std::endl;
+            return false;
+        }
+        if (pins.count(cdrive.direction_pin) || pins.count(cdrive.stepper_pin)
+                || cdrive.direction_pin == cdrive.stepper_pin)
         {
             std::cerr << "Pin already in use (line " << lineno << ")"
                 << std::endl;
             return false;
         }
-        pins |= (PINMASK(cdrive.direction_pin) | PINMASK(cdrive.stepper_pin));
+        pins.insert(cdrive.direction_pin);
+        pins.insert(cdrive.stepper_pin);
         m_drives.push_back(cdrive);
     }
+    if (m_uses_spi && m_spi.registers == 0)
+    {
+        m_spi.registers = pins.empty() ? 1 : *pins.rbegin() / 8 + 1;
+    }
+    if (!m_remotes.empty())
+    {
+        for (DriveList::iterator d = m_drives.begin(); d != m_drives.end(); ++d)
+        {
+            if (d->remote == -1)
+            {
+                std::cerr << "DriveConfig: Local drives can't be mixed with "
+                    "remote ones, run a worker on this host instead"
+                    << std::endl;
+                return false;
+            }
+        }
+    }
     return true;
 }
-#undef PINMASK
 
 
 // Reference to avoid a copy
@@ -131,6 +371,52 @@ DriveList DriveConfig::getDrives() const
 }
 
 
+std::vector<std::string> DriveConfig::getGroups() const
+{
+    return m_groups;
+}
+
+
+/* Returns the index of the drive group with the given name or -1 if
+ * there is no such group.
+ */
+int DriveConfig::groupIndex(std::string const &name) const
+{
+    for (size_t i = 0; i < m_groups.size(); ++i)
+    {
+        if (m_groups[i] == name) return i;
+    }
+    return -1;
+}
+
+
+std::vector<RemoteWorker> DriveConfig::getRemotes() const
+{
+    return m_remotes;
+}
+
+
+bool DriveConfig::usesSpi() const
+{
+    return m_uses_spi;
+}
+
+
+SpiConfig DriveConfig::getSpi() const
+{
+    return m_spi;
+}
+
+
+/* The GPIO character device (e.g. /dev/gpiochip0) the drives are
+ * connected to, or an empty string to use the memory mapped registers
+ */
+std::string DriveConfig::getChip() const
+{
+    return m_chip;
+}
+
+
 bool DriveConfig::isValid() const
 {
     return m_valid;
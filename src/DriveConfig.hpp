@@ -2,32 +2,91 @@
 #define FM_DRIVECONFIG_HPP
 
 #include <istream>
+#include <string>
 #include <vector>
 
 /* This struct stands for a connected drive and contains the pins that
  * this drive is connected to. Each drive needs two pins (three
  * actually, but one is the ground pin which can be the same for every
- * drive), one for the direction and one for the motor pulse.
+ * drive), one for the direction and one for the motor pulse. With a
+ * GPIO character device (see DriveConfig::getChip()) the pins are the
+ * line offsets on the chip, with shift registers (see SpiConfig) the
+ * outputs of the registers, numbered register * 8 + bit.
+ *
+ * group is the index of the drive group (see DriveConfig::getGroups())
+ * or -1 if the drive isn't in a group. low_note and high_note are the
+ * MIDI note numbers the drive should play, notes outside of this range
+ * are shifted by octaves until they fit. pan is the stereo position
+ * (-1 left to 1 right) when rendering, PAN_AUTO spreads the drives
+ * evenly. remote is the index of the worker (see
+ * DriveConfig::getRemotes()) that owns the drive or -1 for a drive on
+ * our own pins. pulse is how long the step pin is held high, in ns.
+ * shard is the drive shard (see DriveShards) that steps the drive, -1
+ * to leave that to DriveShards.
  */
 struct ConnectedDrive
 {
     int direction_pin;
     int stepper_pin;
+    int group;
+    int low_note;
+    int high_note;
+    double pan;
+    int remote;
+    int pulse;
+    int shard;
 };
+#define PAN_AUTO 2.0
 typedef std::vector<ConnectedDrive> DriveList;
 
+/* A floppymusic worker on another host (floppymusic --worker) that
+ * owns some drives.
+ */
+struct RemoteWorker
+{
+    std::string host;
+    int port;
+    int drives;
+};
+
+/* Chained 74HC595 shift registers on a spidev device (see SpiOutput),
+ * from the spi line of the configuration. registers is the number of
+ * registers in the chain, speed the SPI clock in Hz.
+ */
+struct SpiConfig
+{
+    std::string device;
+    int speed;
+    int registers;
+};
+
 class DriveConfig
 {
     private:
     DriveList m_drives;
+    std::vector<std::string> m_groups;
+    std::vector<RemoteWorker> m_remotes;
+    bool m_uses_spi;
+    SpiConfig m_spi;
+    std::string m_chip;
     bool m_valid;
 
     bool read(std::istream &inp);
+    bool readOption(ConnectedDrive &cdrive, std::string const &option);
+    bool readSpi(std::vector<std::string> const &line);
+    bool readChip(std::vector<std::string> const &line);
+    bool readPin(std::string const &field, int &pin) const;
 
     public:
     DriveConfig();
     DriveConfig(std::istream &inp);
     DriveList getDrives() const;
+    std::vector<std::string> getGroups() const;
+    int groupIndex(std::string const &name) const;
+    std::vector<RemoteWorker> getRemotes() const;
+    bool usesSpi() const;
+    SpiConfig getSpi() const;
+    std::string getChip() const;
     bool isValid() const;
 };
 
@@ -0,0 +1,12 @@
+#include "DriveControl.hpp"
+
+DriveControl::~DriveControl()
+{}
+
+
+/* Let the play() and stop() calls that follow take effect at the given
+ * time (CLOCK_MONOTONIC ns) instead of right away, 0 for right away
+ * again. Drives that can't be scheduled ignore it.
+ */
+void DriveControl::schedule(long long at)
+{}
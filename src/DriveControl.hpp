@@ -0,0 +1,18 @@
+#ifndef FM_DRIVECONTROL_HPP
+#define FM_DRIVECONTROL_HPP
+
+/* Anything that can make drive number n play a frequency or stop. The
+ * Player only talks to this, so it doesn't matter if the drives are
+ * stepped by this process or somewhere else.
+ */
+class DriveControl
+{
+    public:
+    virtual ~DriveControl();
+
+    virtual void play(int drive, double frequency) = 0;
+    virtual void stop(int drive) = 0;
+    virtual void schedule(long long at);
+};
+
+#endif
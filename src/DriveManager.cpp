@@ -1,154 +1,420 @@
 #include "DriveManager.hpp"
-#include "gpio.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <unistd.h>
 #define MAX_STEPS 80
-#define RESOLUTION 7200
 #define SEC_IN_NSEC (1000000000)
-DriveManager::DriveManager() : m_running(false)
-{}
+#ifdef FIXED_RIG
+#include "FixedRig.hpp"
+#endif
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * (long long)SEC_IN_NSEC + t.tv_nsec;
+}
+
+
+static void add_sample(LatencyStats &stats, long long latency)
+{
+    if (!stats.count || latency < stats.min)
+    {
+        stats.min = latency;
+    }
+    if (latency > stats.max)
+    {
+        stats.max = latency;
+    }
+    stats.sum += latency;
+    ++stats.count;
+}
 
 
-DriveManager::DriveManager(DriveList drives) : m_running(false)
+/* Prints the statistics in us, e.g. "min 12 us, avg 30 us, max 81 us" */
+std::ostream &operator<<(std::ostream &out, LatencyStats const &stats)
 {
+    if (!stats.count)
+    {
+        return out << "-";
+    }
+    return out << "min " << stats.min / 1000 << " us, avg "
+        << stats.sum / stats.count / 1000 << " us, max "
+        << stats.max / 1000 << " us";
+}
+
+
+DriveManager::DriveManager() :
+    m_output(0)
+{
+    init();
+}
+
+
+/* Create a DriveManager for the given drives, sending the step and
+ * direction signals to output
+ */
+DriveManager::DriveManager(DriveList drives, Output &output) :
+    m_output(&output)
+{
+    init();
     for (DriveList::iterator drv = drives.begin();
             drv != drives.end(); ++drv)
     {
         Drive d = {
+            (int)m_drives.size(),
             drv->direction_pin,
             drv->stepper_pin,
-            0, -1, 0, true};
+            0, -1, 0, true, drv->pulse, 0};
         m_drives.push_back(d);
     }
 }
 
 
-DriveManager::~DriveManager()
+void DriveManager::init()
 {
-    if (!m_running) return;
     m_running = false;
-    pthread_join(m_thread, NULL);
+    m_threaded = false;
+    m_fixed = false;
+    m_parked = false;
+    m_wake_requested = 0;
+    m_stamp = 0;
+    m_at = 0;
+    m_epoch = -1;
+    m_cpu = -1;
+    m_shard = 0;
+    m_heads = 0;
+    m_positioned = false;
+    m_head = 0;
+    m_tail = 0;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_wake, NULL);
+    LatencyStats none = {0, 0, 0, 0};
+    m_latency = none;
+    m_wakeups = none;
 }
 
 
-static void *_drive_jumper(void *drive)
+DriveManager::~DriveManager()
 {
-    reinterpret_cast<DriveManager*>(drive)->loop();
-    return NULL;
+    if (m_running)
+    {
+        pthread_mutex_lock(&m_mutex);
+        m_running = false;
+        pthread_cond_signal(&m_wake);
+        pthread_mutex_unlock(&m_mutex);
+        pthread_join(m_thread, NULL);
+    }
+    if (m_heads && m_positioned && !m_drives.empty())
+    {
+        m_heads->save(&m_drives[0], m_drives.size());
+    }
 }
 
 
-#ifndef FASTIO
-#pragma GCC push_options
-#pragma GCC optimize("O0")
-/* I've wondered for days why one of my drives is working with some test
- * scripts (written in C and Python), but refuses to do anything when
- * used with floppymusic. Turns out that floppymusic is just too fast.
- * The overhead of the C output_gpio() calls or the Python calls were
- * enough to let the drive work.
- *
- * This function does nothing but waste some CPU cycles. It is called
- * between GPIO_SET and GPIO_CLR on the step pins. You can turn this
- * behaviour off by compiling with -DFASTIO (change CC_FLAGS in
- * Makefile accordingly).
- */
-static void _nop_delay(void)
+static void *_drive_jumper(void *drive)
 {
-    for (int i = 15; i > 0; --i)
-    {
-        asm volatile("nop");
-    }
+    reinterpret_cast<DriveManager*>(drive)->loop();
+    return NULL;
 }
-#pragma GCC pop_options
-#endif
 
 
-void DriveManager::setup()
+/* Reseed all drives and start the tick thread. Drives whose head
+ * position is known from the head state (see setHeadState()) aren't
+ * reseeded. If threaded is false no thread is started and the caller
+ * has to call tick() RESOLUTION times per second on its own.
+ */
+void DriveManager::setup(bool threaded)
 {
     if (m_running) return;
     for (Drives::iterator d = m_drives.begin();
             d != m_drives.end(); ++d)
     {
-        // Always use INP before OUT
-        INP_GPIO(d->direction_pin);
-        INP_GPIO(d->stepper_pin);
-        OUT_GPIO(d->direction_pin);
-        OUT_GPIO(d->stepper_pin);
-        
+        TRACE_SCOPE("reseed drive");
+        m_output->setup(*d);
+        if (m_heads && m_heads->restore(*d, MAX_STEPS))
+        {
+            m_output->direction(*d, d->direction);
+            continue;
+        }
         // "reseed" the drive
-#ifndef NOGPIO
-        GPIO_CLR = 1 << d->direction_pin;
-#endif
+        m_output->direction(*d, false);
         for (int i=0; i<MAX_STEPS; ++i)
         {
-#ifndef NOGPIO
-            GPIO_SET = 1 << d->stepper_pin;
-#ifndef FASTIO
-            _nop_delay();
-#endif
-            GPIO_CLR = 1 << d->stepper_pin;
-#endif
+            m_output->step(*d);
+            m_output->flush();
             usleep(2500);
         }
-#ifndef NOGPIO
-        GPIO_SET = 1 << d->direction_pin;
-#endif
+        m_output->direction(*d, true);
+        d->steps = 0;
+        d->direction = true;
+    }
+    m_positioned = true;
+    m_threaded = threaded;
+    if (!m_threaded) return;
+    if (m_epoch == -1)
+    {
+        m_epoch = now_nsec();
     }
-    pthread_mutex_init(&m_mutex, NULL);
-    pthread_create(&m_thread, NULL, _drive_jumper, this);
     m_running = true;
+    pthread_create(&m_thread, NULL, _drive_jumper, this);
+}
+
+
+/* Set the time (CLOCK_MONOTONIC ns) of the first tick, the following
+ * ticks are 1/RESOLUTION s apart from it. Call before setup().
+ */
+void DriveManager::setEpoch(long long epoch)
+{
+    m_epoch = epoch;
+}
+
+
+/* Pin the drive thread to the given CPU. Call before setup(). */
+void DriveManager::setCpu(int cpu)
+{
+    m_cpu = cpu;
+}
+
+
+/* The drive thread counts its ticks in the engine metrics of the given
+ * shard (see Metrics.hpp). Call before setup().
+ */
+void DriveManager::setShard(int shard)
+{
+    m_shard = shard;
+}
+
+
+/* Take the head positions from heads instead of reseeding the drives,
+ * and save them there when the DriveManager is destroyed. Call before
+ * setup().
+ */
+void DriveManager::setHeadState(HeadState *heads)
+{
+    m_heads = heads;
+}
+
+
+/* Tick with the engine compiled for the rig (make FIXED_RIG=...) if
+ * the drives are the ones of the rig, in the same order. The drives
+ * have to be on the GPIO registers, the output is bypassed. Returns
+ * whether the compiled engine is used. Call before setup().
+ */
+bool DriveManager::useFixedRig()
+{
+#ifdef FIXED_RIG
+    int pins[RIG_DRIVES][3] = {{0}};
+    fill_rig_pins<RIG_DRIVES>(pins);
+    if (m_drives.size() != RIG_DRIVES) return false;
+    for (int d = 0; d < RIG_DRIVES; ++d)
+    {
+        if (m_drives[d].direction_pin != pins[d][0]
+                || m_drives[d].stepper_pin != pins[d][1]
+                || m_drives[d].pulse != pins[d][2])
+        {
+            return false;
+        }
+    }
+    m_fixed = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/* Returns the time of the given tick since the epoch, without drifting
+ * off like adding up a rounded tick length would
+ */
+long long DriveManager::tickTime(long long tick) const
+{
+    return m_epoch + tick / RESOLUTION * SEC_IN_NSEC
+        + tick % RESOLUTION * SEC_IN_NSEC / RESOLUTION;
+}
+
+
+/* Returns the first tick at or after the given time */
+static long long tick_at(long long epoch, long long time)
+{
+    long long since = time - epoch;
+    if (since <= 0) return 0;
+    return since / SEC_IN_NSEC * RESOLUTION
+        + (since % SEC_IN_NSEC * RESOLUTION + SEC_IN_NSEC - 1) / SEC_IN_NSEC;
 }
 
 
 void DriveManager::loop()
 {
+    long long tick, deadline, now, lateness;
+    bool overrun, busy;
     timespec t;
-    unsigned long nsec = SEC_IN_NSEC / RESOLUTION;
-    t.tv_sec = nsec / SEC_IN_NSEC;
-    t.tv_nsec = nsec % SEC_IN_NSEC;
+    if (m_cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(m_cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    TRACE_THREAD("drives");
+    tick = tick_at(m_epoch, now_nsec());
     while (m_running)
     {
         pthread_mutex_lock(&m_mutex);
-        for (Drives::iterator d = m_drives.begin();
-                d != m_drives.end(); ++d)
         {
-            if (d->maxticks == -1) continue;
-            ++d->ticks;
-            if (d->ticks >= d->maxticks)
+            TRACE_SCOPE("tick");
+            drain(tickTime(tick));
+            busy = this->tick();
+        }
+        if (!busy)
+        {
+            park();
+        }
+        pthread_mutex_unlock(&m_mutex);
+        if (!busy)
+        {
+            now = now_nsec();
+            deadline = pending();
+            tick = tick_at(m_epoch, now) - 1;
+            if (deadline <= tickTime(tick))
             {
-                // should do a step
-                // need to reverse direction first?
-                ++d->steps;
-                if (d->steps > MAX_STEPS)
-                {
-                    d->direction = !d->direction;
-#ifndef NOGPIO
-                    if (d->direction)
-                    {
-                        GPIO_SET = 1 << d->direction_pin;
-                    }
-                    else 
-                    {
-                        GPIO_CLR = 1 << d->direction_pin;
-                    }
+                // Tick right away, the new note is waiting for its
+                // first step. The ticks after that are back on the grid.
+                continue;
+            }
+            // Nothing to do until the tick the next command is for. That
+            // may be the next one, the last one that passed is too early
+            // for it and draining there would only spin.
+            tick = tick_at(m_epoch, deadline);
+            deadline = tickTime(tick);
+            t.tv_sec = deadline / SEC_IN_NSEC;
+            t.tv_nsec = deadline % SEC_IN_NSEC;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+            continue;
+        }
+
+        // Sleep until the next tick is due
+        deadline = tickTime(++tick);
+        t.tv_sec = deadline / SEC_IN_NSEC;
+        t.tv_nsec = deadline % SEC_IN_NSEC;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+        now = now_nsec();
+        lateness = now - deadline;
+        overrun = lateness > SEC_IN_NSEC / RESOLUTION;
+        if (overrun)
+        {
+            // We missed at least one tick, don't try to catch up
+            tick = tick_at(m_epoch, now) - 1;
+        }
+        metrics_tick(m_shard, lateness, overrun);
+    }
+}
+
+
+/* Block the drive thread until play() gives it something to do. There
+ * is nothing to tick while every drive is silent, which is the case
+ * during rests, before the first and after the last note. It doesn't
+ * block while commands wait for their time. Called by loop() with the
+ * mutex held.
+ */
+void DriveManager::park()
+{
+    __atomic_store_n(&m_parked, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_head, __ATOMIC_SEQ_CST) != m_tail)
+    {
+        // A command came in just now
+        __atomic_store_n(&m_parked, false, __ATOMIC_SEQ_CST);
+        return;
+    }
+    while (m_parked && m_running)
+    {
+        pthread_cond_wait(&m_wake, &m_mutex);
+    }
+    if (!m_wake_requested) return;
+    long long latency = now_nsec() - m_wake_requested;
+    add_sample(m_wakeups, latency);
+    metrics_wake(m_shard, latency);
+    m_wake_requested = 0;
+}
+
+
+/* Advance every drive by one tick and send out the step pulses that
+ * are due. Does no locking, loop() takes care of that. Returns false
+ * if no drive is playing.
+ */
+bool DriveManager::tick()
+{
+#ifdef FIXED_RIG
+    if (m_fixed) return tickFixed();
 #endif
-                    d->steps = 0;
-                }
-                // now send a pulse
+    long long now = 0;
+    bool busy = false;
+    for (Drives::iterator d = m_drives.begin();
+            d != m_drives.end(); ++d)
+    {
+        if (d->maxticks == -1) continue;
+        busy = true;
+        ++d->ticks;
+        if (d->ticks >= d->maxticks)
+        {
+            // should do a step
+            // need to reverse direction first?
+            ++d->steps;
+            if (d->steps > MAX_STEPS)
+            {
+                d->direction = !d->direction;
+                m_output->direction(*d, d->direction);
+                d->steps = 0;
+            }
+            // now send a pulse
+            m_output->step(*d);
+            d->ticks = 0;
+            if (d->since)
+            {
+                if (!now) now = now_nsec();
+                add_sample(m_latency, now - d->since);
+                d->since = 0;
+            }
+        }
+    }
+    m_output->flush();
+    return busy;
+}
+
+
+#ifdef FIXED_RIG
+/* tick() for the rig, see FixedRig.hpp */
+bool DriveManager::tickFixed()
+{
+    RigTick tick = {0, 0, 0, 0, false};
+    RigSweep<RIG_DRIVES>::run(&m_drives[0], tick);
 #ifndef NOGPIO
-                GPIO_SET = 1 << d->stepper_pin;
-#ifndef FASTIO
-                // See definition of _nop_delay for more information
-                _nop_delay();
-#endif
-                GPIO_CLR = 1 << d->stepper_pin;
+    if (tick.forward) GPIO_SET = tick.forward;
+    if (tick.backward) GPIO_CLR = tick.backward;
+    if (tick.steps)
+    {
+        GPIO_SET = tick.steps;
+        int waited = 0;
+        RigClear<RIG_PULSE_GROUPS>::run(tick.steps, waited);
+    }
 #endif
-                d->ticks = 0;
-            }
+    if (tick.stamped)
+    {
+        long long now = now_nsec();
+        for (int d = 0; d < RIG_DRIVES; ++d)
+        {
+            if (!(tick.stamped & (1u << d))) continue;
+            add_sample(m_latency, now - m_drives[d].since);
+            m_drives[d].since = 0;
         }
-        pthread_mutex_unlock(&m_mutex);
-        nanosleep(&t, NULL);
     }
+    return tick.busy;
 }
+#endif
 
 
 void DriveManager::play(int drive, double frequency)
@@ -158,15 +424,149 @@ void DriveManager::play(int drive, double frequency)
         this->stop(drive);
         return;
     }
-    pthread_mutex_lock(&m_mutex);
+    long long since = m_stamp;
+    m_stamp = 0;
+    send(drive, ticksFor(frequency), since);
+}
+
+
+/* Apply the play() and stop() calls that follow on the first tick at or
+ * after at (CLOCK_MONOTONIC ns), 0 to apply them with the next tick.
+ * Only the drive thread waits for the time, without it the commands
+ * are applied right away.
+ */
+void DriveManager::schedule(long long at)
+{
+    m_at = at;
+}
+
+
+/* Hand a command to the drive thread, or apply it right away if there
+ * is none
+ */
+void DriveManager::send(int drive, int maxticks, long long since)
+{
+    if (!m_threaded)
+    {
+        apply(drive, maxticks, since);
+        return;
+    }
+    unsigned int head = m_head;
+    while (head - __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE)
+            >= COMMAND_QUEUE_SIZE)
+    {
+        // The drive thread is way behind, give it a chance
+        sched_yield();
+    }
+    Command &command = m_queue[head % COMMAND_QUEUE_SIZE];
+    command.drive = drive;
+    command.maxticks = maxticks;
+    command.since = since;
+    command.at = m_at;
+    __atomic_store_n(&m_head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_parked, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&m_mutex);
+        if (m_parked)
+        {
+            __atomic_store_n(&m_parked, false, __ATOMIC_SEQ_CST);
+            m_wake_requested = now_nsec();
+            pthread_cond_signal(&m_wake);
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+}
+
+
+void DriveManager::apply(int drive, int maxticks, long long since)
+{
     Drive& d = m_drives[drive];
-    d.ticks = 0;
-    d.maxticks = RESOLUTION / frequency;
-    pthread_mutex_unlock(&m_mutex);
+    d.maxticks = maxticks;
+    if (maxticks == -1)
+    {
+        d.since = 0;
+        return;
+    }
+    // The first step is sent with the next tick, not a period later
+    d.ticks = maxticks - 1;
+    d.since = since;
+}
+
+
+/* Apply the commands that came in since the last tick and are due at
+ * now, the time of the tick. Called by the drive thread.
+ */
+void DriveManager::drain(long long now)
+{
+    unsigned int head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+    unsigned int t;
+    for (t = m_tail; t != head; ++t)
+    {
+        Command const &command = m_queue[t % COMMAND_QUEUE_SIZE];
+        if (command.at > now) break;
+        apply(command.drive, command.maxticks, command.since);
+    }
+    __atomic_store_n(&m_tail, t, __ATOMIC_RELEASE);
+}
+
+
+/* Returns the time of the next command that waits in the queue, 0 if
+ * it's due right away and -1 if there is none. Called by the drive
+ * thread.
+ */
+long long DriveManager::pending()
+{
+    unsigned int head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+    if (head == m_tail) return -1;
+    return m_queue[m_tail % COMMAND_QUEUE_SIZE].at;
+}
+
+
+/* Remember when the input that leads to the next play() arrived. The
+ * time until the first step of that note is added to latency().
+ */
+void DriveManager::stampNextPlay(long long since)
+{
+    m_stamp = since;
+}
+
+
+LatencyStats DriveManager::latency()
+{
+    if (m_threaded) pthread_mutex_lock(&m_mutex);
+    LatencyStats result = m_latency;
+    if (m_threaded) pthread_mutex_unlock(&m_mutex);
+    return result;
+}
+
+
+/* How long the drive thread took to wake up after it was parked */
+LatencyStats DriveManager::wakeups()
+{
+    if (m_threaded) pthread_mutex_lock(&m_mutex);
+    LatencyStats result = m_wakeups;
+    if (m_threaded) pthread_mutex_unlock(&m_mutex);
+    return result;
 }
 
 
 void DriveManager::stop(int drive)
 {
-    m_drives[drive].maxticks = -1;
+    send(drive, -1, 0);
+}
+
+
+bool DriveManager::playing(int drive) const
+{
+    return m_drives[drive].maxticks != -1;
+}
+
+
+/* Returns the number of ticks between two steps for the given
+ * frequency. Since it's a whole number of ticks the frequency that is
+ * actually played is RESOLUTION / ticksFor(frequency).
+ */
+int DriveManager::ticksFor(double frequency)
+{
+    return RESOLUTION / frequency;
 }
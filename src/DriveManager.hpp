@@ -2,37 +2,146 @@
 #define FM_DRIVEMANAGER_HPP
 
 #include "DriveConfig.hpp"
+#include "DriveControl.hpp"
+#include "HeadState.hpp"
+#include "Output.hpp"
+#include <ostream>
 #include <pthread.h>
 #include <vector>
 
+// Number of ticks per second
+#define RESOLUTION 7200
+
 struct Drive
 {
+    int index;
     int direction_pin;
     int stepper_pin;
     int ticks;
     int maxticks;
     int steps;
     bool direction;
+    // Step pulse width in ns
+    int pulse;
+    // Time (CLOCK_MONOTONIC ns) the input for the current note arrived,
+    // 0 if nobody is waiting for its first step
+    long long since;
 };
 typedef std::vector<Drive> Drives;
 
-class DriveManager
+/* Statistics of a latency in ns, like the time between an input and
+ * the first step of the note it started (see
+ * DriveManager::stampNextPlay()) or the time the drive thread needs to
+ * wake up.
+ */
+struct LatencyStats
+{
+    long long count;
+    long long sum;
+    long long min;
+    long long max;
+};
+
+std::ostream &operator<<(std::ostream &out, LatencyStats const &stats);
+
+// Number of play/stop commands that can wait for the drive thread
+#define COMMAND_QUEUE_SIZE 256
+
+/* Steps a set of drives RESOLUTION times per second, either from a
+ * thread of its own (setup(true)) or from whoever calls tick().
+ *
+ * With the thread play() and stop() don't touch the drives, they put a
+ * command into a lock-free queue that the drive thread works off at the
+ * start of the next tick. The ticks are on a grid that starts at the
+ * epoch, so several DriveManagers with the same epoch tick in phase
+ * (see DriveShards).
+ *
+ * After schedule() the commands wait in the queue until the first tick
+ * at or after their time, so a note starts on that very tick however
+ * late the playing thread was, as long as it sends its commands ahead
+ * of time. They are applied in the order they were sent, so their times
+ * mustn't go back and mustn't be further ahead than the queue can hold.
+ */
+class DriveManager : public DriveControl
 {
     private:
+    struct Command
+    {
+        int drive;
+        int maxticks; // -1 to stop the drive
+        long long since;
+        // When to apply it, 0 for right away
+        long long at;
+    };
+
     bool m_running;
+    bool m_threaded;
+    // Tick with the engine compiled for the rig (see FixedRig.hpp)
+    bool m_fixed;
     Drives m_drives;
+    Output *m_output;
+    HeadState *m_heads;
+    // The head positions are known, setup() reseeded or restored them
+    bool m_positioned;
     pthread_t m_thread;
+    // Protects the statistics and the parking
     pthread_mutex_t m_mutex;
+    // Signalled by play() when the drive thread is parked
+    pthread_cond_t m_wake;
+    bool m_parked;
+    long long m_wake_requested;
+    long long m_stamp;
+    // Time of the commands that are sent, see schedule()
+    long long m_at;
+    long long m_epoch;
+    int m_cpu;
+    // Engine part of the metrics the drive thread writes
+    int m_shard;
+    LatencyStats m_latency;
+    LatencyStats m_wakeups;
+    Command m_queue[COMMAND_QUEUE_SIZE];
+    // Written by the playing thread only
+    unsigned int m_head;
+    // Written by the drive thread only
+    unsigned int m_tail;
+
+    DriveManager(DriveManager const &other);
+    DriveManager& operator=(DriveManager const &other);
+
+    void init();
+    void park();
+    void send(int drive, int maxticks, long long since);
+    void apply(int drive, int maxticks, long long since);
+    void drain(long long now);
+    long long pending();
+    long long tickTime(long long tick) const;
+#ifdef FIXED_RIG
+    bool tickFixed();
+#endif
 
     public:
     DriveManager();
-    DriveManager(DriveList drives);
+    DriveManager(DriveList drives, Output &output);
     ~DriveManager();
 
     void loop();
-    void setup();
-    void play(int drive, double freq);
-    void stop(int drive);
+    bool tick();
+    void setup(bool threaded = true);
+    void setEpoch(long long epoch);
+    void setCpu(int cpu);
+    void setShard(int shard);
+    void setHeadState(HeadState *heads);
+    bool useFixedRig();
+    virtual void play(int drive, double freq);
+    virtual void stop(int drive);
+    virtual void schedule(long long at);
+
+    void stampNextPlay(long long since);
+    LatencyStats latency();
+    LatencyStats wakeups();
+
+    bool playing(int drive) const;
+    static int ticksFor(double frequency);
 };
 
 #endif
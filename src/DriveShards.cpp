@@ -0,0 +1,205 @@
+#include "DriveShards.hpp"
+#include <time.h>
+#include <unistd.h>
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/* Decide which shard steps which drive. Drives with a shard from the
+ * configuration keep it, the others go to the shard with the fewest
+ * drives. shards is the number of shards to use, 0 for one per CPU
+ * core except the first (which is left to the play thread). Returns
+ * the number of shards.
+ */
+int DriveShards::assign(DriveList &drives, int shards)
+{
+    if (shards <= 0)
+    {
+        shards = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+        if (shards > (int)drives.size()) shards = drives.size();
+        if (shards < 1) shards = 1;
+    }
+    for (DriveList::iterator d = drives.begin(); d != drives.end(); ++d)
+    {
+        if (d->shard >= shards) shards = d->shard + 1;
+    }
+    std::vector<int> load(shards, 0);
+    for (DriveList::iterator d = drives.begin(); d != drives.end(); ++d)
+    {
+        if (d->shard != -1) ++load[d->shard];
+    }
+    for (DriveList::iterator d = drives.begin(); d != drives.end(); ++d)
+    {
+        if (d->shard != -1) continue;
+        int lightest = 0;
+        for (int s = 1; s < shards; ++s)
+        {
+            if (load[s] < load[lightest]) lightest = s;
+        }
+        d->shard = lightest;
+        ++load[lightest];
+    }
+    return shards;
+}
+
+
+/* Split the drives into the given number of shards, the drives have to
+ * be assign()ed already. If output is given the drives use it instead
+ * of the GPIO pins, which only works with a single shard.
+ */
+DriveShards::DriveShards(DriveList const &drives, int shards, Output *output) :
+    m_stamp(0)
+{
+    std::vector<DriveList> split(shards);
+    for (DriveList::const_iterator d = drives.begin(); d != drives.end(); ++d)
+    {
+        Location location = {d->shard, (int)split[d->shard].size()};
+        m_locations.push_back(location);
+        split[d->shard].push_back(*d);
+    }
+    for (int s = 0; s < shards; ++s)
+    {
+        if (!output)
+        {
+            m_outputs.push_back(new GpioOutput());
+        }
+        m_shards.push_back(new DriveManager(split[s],
+                    output ? *output : *m_outputs[s]));
+        m_shards.back()->setShard(s);
+    }
+}
+
+
+DriveShards::~DriveShards()
+{
+    // Stop the threads before their outputs go away
+    for (size_t s = 0; s < m_shards.size(); ++s)
+    {
+        delete m_shards[s];
+    }
+    for (size_t s = 0; s < m_outputs.size(); ++s)
+    {
+        delete m_outputs[s];
+    }
+}
+
+
+/* Reseed the drives and start the tick threads. With more than one
+ * shard shard n is pinned to CPU n + 1.
+ */
+void DriveShards::setup()
+{
+    long long epoch = now_nsec();
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (size_t s = 0; s < m_shards.size(); ++s)
+    {
+        m_shards[s]->setEpoch(epoch);
+        if (m_shards.size() > 1 && cpus > 1)
+        {
+            m_shards[s]->setCpu((s + 1) % cpus);
+        }
+        m_shards[s]->setup();
+    }
+}
+
+
+void DriveShards::play(int drive, double freq)
+{
+    Location const &location = m_locations[drive];
+    DriveManager *shard = m_shards[location.shard];
+    shard->stampNextPlay(m_stamp);
+    m_stamp = 0;
+    shard->play(location.drive, freq);
+}
+
+
+void DriveShards::stop(int drive)
+{
+    Location const &location = m_locations[drive];
+    m_shards[location.shard]->stop(location.drive);
+}
+
+
+/* See DriveManager::schedule(), every shard has a queue of its own */
+void DriveShards::schedule(long long at)
+{
+    for (size_t s = 0; s < m_shards.size(); ++s)
+    {
+        m_shards[s]->schedule(at);
+    }
+}
+
+
+/* See DriveManager::stampNextPlay() */
+void DriveShards::stampNextPlay(long long since)
+{
+    m_stamp = since;
+}
+
+
+static void merge(LatencyStats &into, LatencyStats const &stats)
+{
+    if (!stats.count) return;
+    if (!into.count || stats.min < into.min) into.min = stats.min;
+    if (stats.max > into.max) into.max = stats.max;
+    into.sum += stats.sum;
+    into.count += stats.count;
+}
+
+
+/* The input to step latency of all shards together */
+LatencyStats DriveShards::latency()
+{
+    LatencyStats result = {0, 0, 0, 0};
+    for (size_t s = 0; s < m_shards.size(); ++s)
+    {
+        merge(result, m_shards[s]->latency());
+    }
+    return result;
+}
+
+
+/* The wake-up latency of all shards together */
+LatencyStats DriveShards::wakeups()
+{
+    LatencyStats result = {0, 0, 0, 0};
+    for (size_t s = 0; s < m_shards.size(); ++s)
+    {
+        merge(result, m_shards[s]->wakeups());
+    }
+    return result;
+}
+
+
+/* Restore and save the head positions of every shard's drives (see
+ * DriveManager::setHeadState()). Call before setup().
+ */
+void DriveShards::setHeadState(HeadState *heads)
+{
+    for (size_t s = 0; s < m_shards.size(); ++s)
+    {
+        m_shards[s]->setHeadState(heads);
+    }
+}
+
+
+/* Use the engine compiled for the rig (see DriveManager::useFixedRig()),
+ * which only knows a single drive thread. Call before setup().
+ */
+bool DriveShards::useFixedRig()
+{
+    return m_shards.size() == 1 && m_shards[0]->useFixedRig();
+}
+
+
+/* Returns the number of shards */
+int DriveShards::size() const
+{
+    return m_shards.size();
+}
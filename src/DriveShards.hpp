@@ -0,0 +1,56 @@
+#ifndef FM_DRIVE_SHARDS_HPP
+#define FM_DRIVE_SHARDS_HPP
+
+#include "DriveConfig.hpp"
+#include "DriveControl.hpp"
+#include "DriveManager.hpp"
+#include "GpioOutput.hpp"
+#include <vector>
+
+/* The drives of a big rig, split into shards. Every shard is a
+ * DriveManager with its own tick thread, pinned to a core of its own,
+ * its own command queue and its own GpioOutput, which only ever writes
+ * the pins of the shard's drives (unless all drives share another
+ * Output, like the shift registers of SpiOutput). All shards tick on
+ * the same grid (they share the epoch), so they stay in phase.
+ *
+ * The drive numbers are the ones of the drive configuration, the
+ * DriveShards pass the commands on to the right shard.
+ */
+class DriveShards : public DriveControl
+{
+    private:
+    struct Location
+    {
+        int shard;
+        int drive;
+    };
+
+    std::vector<GpioOutput*> m_outputs;
+    std::vector<DriveManager*> m_shards;
+    std::vector<Location> m_locations;
+    long long m_stamp;
+
+    DriveShards(DriveShards const &other);
+    DriveShards& operator=(DriveShards const &other);
+
+    public:
+    DriveShards(DriveList const &drives, int shards, Output *output = 0);
+    ~DriveShards();
+
+    static int assign(DriveList &drives, int shards);
+
+    void setup();
+    void setHeadState(HeadState *heads);
+    bool useFixedRig();
+    virtual void play(int drive, double freq);
+    virtual void stop(int drive);
+    virtual void schedule(long long at);
+
+    void stampNextPlay(long long since);
+    LatencyStats latency();
+    LatencyStats wakeups();
+    int size() const;
+};
+
+#endif
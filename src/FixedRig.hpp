@@ -0,0 +1,119 @@
+#ifndef FM_FIXED_RIG_HPP
+#define FM_FIXED_RIG_HPP
+
+/* The drive engine for a rig that is known at compile time. make
+ * FIXED_RIG=drives.cfg turns the drive configuration into rig.hpp (see
+ * tools/rig.awk), with a RigDrive specialization for every drive and a
+ * RigPulse specialization for every pulse width. The sweep over the
+ * drives is unrolled by the templates below, so every pin mask is a
+ * constant and there is no loop and no call through Output left.
+ *
+ * DriveManager::tick() uses it when the drives are the ones of the rig
+ * (see DriveManager::useFixedRig()). It does the same as the generic
+ * tick with GpioOutput. Only included by DriveManager.cpp, which
+ * defines MAX_STEPS.
+ */
+
+#include "Delay.hpp"
+#include "DriveManager.hpp"
+#include "gpio.hpp"
+
+template <int D> struct RigDrive;
+template <int G> struct RigPulse;
+
+#include "rig.hpp"
+
+// What the sweep of one tick has to write
+struct RigTick
+{
+    unsigned int steps;
+    unsigned int forward;
+    unsigned int backward;
+    // Drives (by index) that did the first step of a stamped note
+    unsigned int stamped;
+    bool busy;
+};
+
+
+/* Advance the drives 0 to D - 1 by a tick */
+template <int D>
+struct RigSweep
+{
+    static inline void run(Drive *drives, RigTick &tick)
+    {
+        RigSweep<D - 1>::run(drives, tick);
+        Drive &d = drives[D - 1];
+        if (d.maxticks == -1) return;
+        tick.busy = true;
+        if (++d.ticks < d.maxticks) return;
+        if (++d.steps > MAX_STEPS)
+        {
+            d.direction = !d.direction;
+            if (d.direction)
+            {
+                tick.forward |= 1u << RigDrive<D - 1>::DIRECTION_PIN;
+            }
+            else
+            {
+                tick.backward |= 1u << RigDrive<D - 1>::DIRECTION_PIN;
+            }
+            d.steps = 0;
+        }
+        tick.steps |= 1u << RigDrive<D - 1>::STEPPER_PIN;
+        d.ticks = 0;
+        if (d.since)
+        {
+            tick.stamped |= 1u << (D - 1);
+        }
+    }
+};
+
+template <>
+struct RigSweep<0>
+{
+    static inline void run(Drive *drives, RigTick &tick) {}
+};
+
+
+/* Clear the step pins of the pulse groups 0 to G - 1 when their pulse
+ * width is over, shortest first. waited is how long the pins have been
+ * high so far.
+ */
+template <int G>
+struct RigClear
+{
+    static inline void run(unsigned int steps, int &waited)
+    {
+        RigClear<G - 1>::run(steps, waited);
+        unsigned int pins = steps & RigPulse<G - 1>::PINS;
+        if (!pins) return;
+        delay_nsec(RigPulse<G - 1>::WIDTH - waited);
+        waited = RigPulse<G - 1>::WIDTH;
+        GPIO_CLR = pins;
+    }
+};
+
+template <>
+struct RigClear<0>
+{
+    static inline void run(unsigned int steps, int &waited) {}
+};
+
+
+/* Put the pins and the pulse width of the drives 0 to D - 1 into pins,
+ * to compare them with a drive configuration
+ */
+template <int D>
+inline void fill_rig_pins(int pins[][3])
+{
+    fill_rig_pins<D - 1>(pins);
+    pins[D - 1][0] = RigDrive<D - 1>::DIRECTION_PIN;
+    pins[D - 1][1] = RigDrive<D - 1>::STEPPER_PIN;
+    pins[D - 1][2] = RigDrive<D - 1>::PULSE;
+}
+
+template <>
+inline void fill_rig_pins<0>(int pins[][3])
+{}
+
+#endif
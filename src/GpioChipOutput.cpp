@@ -0,0 +1,129 @@
+#include "GpioChipOutput.hpp"
+#include "Delay.hpp"
+#include "DriveManager.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+
+GpioChipOutput::GpioChipOutput(std::string const &chip) :
+    m_chip(chip), m_fd(-1), m_steps(0)
+{
+    calibrate_delay();
+}
+
+
+GpioChipOutput::~GpioChipOutput()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+
+/* Request the lines of all drives as outputs. Returns false on error. */
+bool GpioChipOutput::open(DriveList const &drives)
+{
+    gpio_v2_line_request request;
+    std::memset(&request, 0, sizeof(request));
+    for (DriveList::const_iterator d = drives.begin(); d != drives.end(); ++d)
+    {
+        int pins[] = {d->direction_pin, d->stepper_pin};
+        for (int p = 0; p < 2; ++p)
+        {
+            if (request.num_lines == GPIO_V2_LINES_MAX)
+            {
+                std::cerr << m_chip << ": Can't use more than "
+                    << GPIO_V2_LINES_MAX / 2 << " drives" << std::endl;
+                return false;
+            }
+            if ((int)m_bits.size() <= pins[p])
+            {
+                m_bits.resize(pins[p] + 1, -1);
+            }
+            m_bits[pins[p]] = request.num_lines;
+            request.offsets[request.num_lines++] = pins[p];
+        }
+    }
+    std::strncpy(request.consumer, "floppymusic", GPIO_MAX_NAME_SIZE - 1);
+    request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+
+    int chip = ::open(m_chip.c_str(), O_RDWR | O_CLOEXEC);
+    if (chip < 0)
+    {
+        std::cerr << "Can't open " << m_chip << ": " << std::strerror(errno)
+            << std::endl;
+        return false;
+    }
+    int result = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &request);
+    int error = errno;
+    close(chip);
+    if (result < 0)
+    {
+        std::cerr << "Can't request the lines from " << m_chip << ": "
+            << std::strerror(error) << std::endl;
+        return false;
+    }
+    m_fd = request.fd;
+    return true;
+}
+
+
+void GpioChipOutput::set(unsigned long long lines, unsigned long long values)
+{
+    gpio_v2_line_values request = {values, lines};
+    ioctl(m_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &request);
+}
+
+
+void GpioChipOutput::setup(Drive const &drive)
+{
+    std::vector<PulseGroup>::iterator group = m_pulses.begin();
+    while (group != m_pulses.end() && group->width < drive.pulse)
+    {
+        ++group;
+    }
+    if (group == m_pulses.end() || group->width != drive.pulse)
+    {
+        PulseGroup g = {drive.pulse, 0};
+        group = m_pulses.insert(group, g);
+    }
+    group->lines |= 1ULL << m_bits[drive.stepper_pin];
+}
+
+
+void GpioChipOutput::direction(Drive const &drive, bool forward)
+{
+    unsigned long long line = 1ULL << m_bits[drive.direction_pin];
+    set(line, forward ? line : 0);
+}
+
+
+void GpioChipOutput::step(Drive const &drive)
+{
+    m_steps |= 1ULL << m_bits[drive.stepper_pin];
+}
+
+
+void GpioChipOutput::flush()
+{
+    if (!m_steps) return;
+    set(m_steps, m_steps);
+    // The pulses have been high for waited ns so far
+    int waited = 0;
+    for (std::vector<PulseGroup>::const_iterator group = m_pulses.begin();
+            group != m_pulses.end(); ++group)
+    {
+        unsigned long long lines = m_steps & group->lines;
+        if (!lines) continue;
+        delay_nsec(group->width - waited);
+        waited = group->width;
+        set(lines, 0);
+    }
+    m_steps = 0;
+}
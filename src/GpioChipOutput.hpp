@@ -0,0 +1,56 @@
+#ifndef FM_GPIO_CHIP_OUTPUT_HPP
+#define FM_GPIO_CHIP_OUTPUT_HPP
+
+#include "DriveConfig.hpp"
+#include "Output.hpp"
+#include <string>
+#include <vector>
+
+/* Output to the lines of a GPIO character device (/dev/gpiochipN),
+ * using the v2 uAPI of the kernel. Unlike GpioOutput this needs neither
+ * root nor the address of the GPIO registers, so it also works on
+ * boards where those are somewhere else, like the Pi 5, and with the
+ * gpio-sim module.
+ *
+ * All lines of the drives are requested together, so the step lines of
+ * a tick are set with a single ioctl and cleared with one ioctl per
+ * pulse width, like GpioOutput does with the registers. A request can
+ * hold up to 64 lines, which is 32 drives.
+ */
+class GpioChipOutput : public Output
+{
+    private:
+    // The step lines of all drives with the same pulse width
+    struct PulseGroup
+    {
+        int width;
+        unsigned long long lines;
+    };
+
+    std::string m_chip;
+    // The fd of the line request
+    int m_fd;
+    // The bit of every pin in the request, -1 for the pins we don't use
+    std::vector<int> m_bits;
+    unsigned long long m_steps;
+    // Sorted by width
+    std::vector<PulseGroup> m_pulses;
+
+    GpioChipOutput(GpioChipOutput const &other);
+    GpioChipOutput& operator=(GpioChipOutput const &other);
+
+    void set(unsigned long long lines, unsigned long long values);
+
+    public:
+    GpioChipOutput(std::string const &chip);
+    ~GpioChipOutput();
+
+    bool open(DriveList const &drives);
+
+    virtual void setup(Drive const &drive);
+    virtual void direction(Drive const &drive, bool forward);
+    virtual void step(Drive const &drive);
+    virtual void flush();
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "GpioOutput.hpp"
+#include "Delay.hpp"
+#include "DriveManager.hpp"
+#include "gpio.hpp"
+
+
+/* I've wondered for days why one of my drives is working with some test
+ * scripts (written in C and Python), but refuses to do anything when
+ * used with floppymusic. Turns out that floppymusic is just too fast.
+ * The overhead of the C output_gpio() calls or the Python calls were
+ * enough to let the drive work.
+ *
+ * That's why the step pin stays high for the pulse width of the drive
+ * (pulse= in drives.cfg) before it is cleared again. The delay loop for
+ * that is calibrated here, once.
+ */
+GpioOutput::GpioOutput() : m_steps(0)
+{
+    calibrate_delay();
+}
+
+
+void GpioOutput::setup(Drive const &drive)
+{
+    // Always use INP before OUT
+    INP_GPIO(drive.direction_pin);
+    INP_GPIO(drive.stepper_pin);
+    OUT_GPIO(drive.direction_pin);
+    OUT_GPIO(drive.stepper_pin);
+
+    std::vector<PulseGroup>::iterator group = m_pulses.begin();
+    while (group != m_pulses.end() && group->width < drive.pulse)
+    {
+        ++group;
+    }
+    if (group == m_pulses.end() || group->width != drive.pulse)
+    {
+        PulseGroup g = {drive.pulse, 0};
+        group = m_pulses.insert(group, g);
+    }
+    group->pins |= 1 << drive.stepper_pin;
+}
+
+
+void GpioOutput::direction(Drive const &drive, bool forward)
+{
+#ifndef NOGPIO
+    if (forward)
+    {
+        GPIO_SET = 1 << drive.direction_pin;
+    }
+    else
+    {
+        GPIO_CLR = 1 << drive.direction_pin;
+    }
+#endif
+}
+
+
+void GpioOutput::step(Drive const &drive)
+{
+    m_steps |= 1 << drive.stepper_pin;
+}
+
+
+void GpioOutput::flush()
+{
+    if (!m_steps) return;
+#ifndef NOGPIO
+    GPIO_SET = m_steps;
+    // The pulses have been high for waited ns so far
+    int waited = 0;
+    for (std::vector<PulseGroup>::const_iterator group = m_pulses.begin();
+            group != m_pulses.end(); ++group)
+    {
+        unsigned int pins = m_steps & group->pins;
+        if (!pins) continue;
+        delay_nsec(group->width - waited);
+        waited = group->width;
+        GPIO_CLR = pins;
+    }
+#endif
+    m_steps = 0;
+}
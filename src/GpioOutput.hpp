@@ -0,0 +1,37 @@
+#ifndef FM_GPIO_OUTPUT_HPP
+#define FM_GPIO_OUTPUT_HPP
+
+#include "Output.hpp"
+#include <vector>
+
+/* Output to the GPIO pins of the Pi, using the memory mapped registers
+ * (see gpio.hpp, setup_io() has to be called first). All step pins of
+ * a tick are set together with a single register write. They are
+ * cleared again as soon as the pulse width of the respective drive is
+ * over, the drives with the shortest pulse first, so a tick only takes
+ * as long as the slowest drive that actually steps in it.
+ */
+class GpioOutput : public Output
+{
+    private:
+    // The step pins of all drives with the same pulse width
+    struct PulseGroup
+    {
+        int width;
+        unsigned int pins;
+    };
+
+    unsigned int m_steps;
+    // Sorted by width
+    std::vector<PulseGroup> m_pulses;
+
+    public:
+    GpioOutput();
+
+    virtual void setup(Drive const &drive);
+    virtual void direction(Drive const &drive, bool forward);
+    virtual void step(Drive const &drive);
+    virtual void flush();
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "HeadState.hpp"
+#include "DriveManager.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#define HEAD_STATE_MAGIC "floppymusic-heads 1"
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+
+/* The id of the running boot, a drive may have been moved by hand (or
+ * swapped) while the system was down
+ */
+static std::string boot_id()
+{
+    std::ifstream inp(BOOT_ID_PATH);
+    std::string id;
+    std::getline(inp, id);
+    return id;
+}
+
+
+HeadState::HeadState(std::string const &path) :
+    m_path(path)
+{}
+
+
+/* Read the positions and remove the file. Returns false if there was no
+ * usable file, then every drive is reseeded.
+ */
+bool HeadState::load()
+{
+    std::ifstream inp(m_path.c_str());
+    if (!inp.good())
+    {
+        return false;
+    }
+    std::string line;
+    std::getline(inp, line);
+    bool valid = line == HEAD_STATE_MAGIC;
+    std::getline(inp, line);
+    valid = valid && line == "boot " + boot_id();
+    while (valid && std::getline(inp, line))
+    {
+        std::stringstream ss(line);
+        std::string keyword;
+        Pins pins;
+        Head head;
+        int direction;
+        ss >> keyword >> pins.first >> pins.second >> head.steps >> direction;
+        valid = !ss.fail() && keyword == "drive" && head.steps >= 0
+            && (direction == 0 || direction == 1);
+        head.direction = direction;
+        m_heads[pins] = head;
+    }
+    inp.close();
+    // From now on a crash leaves no file behind
+    std::remove(m_path.c_str());
+    if (!valid)
+    {
+        std::cout << "The head positions in " << m_path << " are stale, "
+            "reseeding the drives" << std::endl;
+        m_heads.clear();
+    }
+    return valid;
+}
+
+
+/* Put the head of drive where it was at the last exit. Returns false if
+ * the position isn't known, then the drive has to be reseeded.
+ */
+bool HeadState::restore(Drive &drive, int max_steps)
+{
+    std::map<Pins, Head>::iterator head = m_heads.find(
+            Pins(drive.direction_pin, drive.stepper_pin));
+    if (head == m_heads.end())
+    {
+        return false;
+    }
+    bool known = head->second.steps <= max_steps;
+    if (known)
+    {
+        drive.steps = head->second.steps;
+        drive.direction = head->second.direction;
+    }
+    // Until the drive is saved again its head moves
+    m_heads.erase(head);
+    return known;
+}
+
+
+/* Add the positions of the given drives and write the file. The drive
+ * threads of the drives have to be stopped.
+ */
+bool HeadState::save(Drive const *drives, int count)
+{
+    for (int d = 0; d < count; ++d)
+    {
+        Head head = {drives[d].steps, drives[d].direction};
+        m_heads[Pins(drives[d].direction_pin, drives[d].stepper_pin)] = head;
+    }
+    // Write a new file and move it over the old one, so that a crash
+    // halfway through can't leave half a file
+    std::string temp = m_path + ".new";
+    std::ofstream out(temp.c_str());
+    out << HEAD_STATE_MAGIC << "\n"
+        << "boot " << boot_id() << "\n";
+    for (std::map<Pins, Head>::iterator head = m_heads.begin();
+            head != m_heads.end(); ++head)
+    {
+        out << "drive " << head->first.first << " " << head->first.second
+            << " " << head->second.steps << " " << head->second.direction
+            << "\n";
+    }
+    out.close();
+    if (out.fail() || std::rename(temp.c_str(), m_path.c_str()) != 0)
+    {
+        std::cerr << "Can't write " << m_path << ": " << std::strerror(errno)
+            << std::endl;
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
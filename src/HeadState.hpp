@@ -0,0 +1,45 @@
+#ifndef FM_HEAD_STATE_HPP
+#define FM_HEAD_STATE_HPP
+
+#include <map>
+#include <string>
+#include <utility>
+
+struct Drive;
+
+/* Where the heads of the drives were when floppymusic last exited
+ * cleanly, kept in a small file so that the drives don't have to be
+ * reseeded on the next start.
+ *
+ * load() removes the file after reading it. A DriveManager takes the
+ * positions of its drives when it is set up and saves them when it is
+ * destroyed, after its drive thread has stopped. If floppymusic dies in
+ * between there is no file, and the next start reseeds every drive.
+ * Drives are known by their pins, so a changed configuration only
+ * reseeds the drives that changed. The file is stale after a reboot.
+ */
+class HeadState
+{
+    private:
+    struct Head
+    {
+        int steps;
+        bool direction;
+    };
+    typedef std::pair<int, int> Pins;
+
+    std::string m_path;
+    std::map<Pins, Head> m_heads;
+
+    HeadState(HeadState const &other);
+    HeadState& operator=(HeadState const &other);
+
+    public:
+    HeadState(std::string const &path);
+
+    bool load();
+    bool restore(Drive &drive, int max_steps);
+    bool save(Drive const *drives, int count);
+};
+
+#endif
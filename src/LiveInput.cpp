@@ -0,0 +1,128 @@
+#include "LiveInput.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+
+#define SEC_IN_NSEC (1000000000LL)
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * SEC_IN_NSEC + t.tv_nsec;
+}
+
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int)
+{
+    interrupted = 1;
+}
+
+
+LiveInput::LiveInput(DriveShards &dmgr, Player &player,
+        Transform const &transform, int min_velocity, int drive_count) :
+    m_dmgr(dmgr), m_player(player), m_transform(transform),
+    m_min_velocity(min_velocity), m_dcount(drive_count), m_fd(-1),
+    m_stream(*this), m_received(0), m_notes(0)
+{}
+
+
+LiveInput::~LiveInput()
+{
+    if (m_fd > STDIN_FILENO)
+    {
+        close(m_fd);
+    }
+}
+
+
+/* Open the device or pipe to read from, "-" is stdin. Returns false on
+ * error.
+ */
+bool LiveInput::open(std::string const &path)
+{
+    if (path == "-")
+    {
+        m_fd = STDIN_FILENO;
+        return true;
+    }
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+    {
+        std::cerr << "Can't open " << path << ": " << std::strerror(errno)
+            << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/* Play until the end of the stream or until interrupted with Ctrl+C */
+void LiveInput::run()
+{
+    // No SA_RESTART, the read() has to return on Ctrl+C
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = on_interrupt;
+    sigaction(SIGINT, &action, NULL);
+
+    unsigned char buffer[256];
+    while (!interrupted)
+    {
+        ssize_t len = read(m_fd, buffer, sizeof(buffer));
+        if (len < 0)
+        {
+            if (errno == EINTR) continue;
+            std::cerr << "LiveInput: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        if (len == 0) break;
+        m_received = now_nsec();
+        m_stream.push(buffer, len);
+    }
+
+    for (int d = 0; d < m_dcount; ++d)
+    {
+        m_dmgr.stop(d);
+    }
+    signal(SIGINT, SIG_DFL);
+}
+
+
+void LiveInput::noteOn(int channel, int note, int velocity)
+{
+    if (velocity < m_min_velocity) return;
+    int group;
+    note = m_transform.mapNote(channel, note, group);
+    ++m_notes;
+    m_dmgr.stampNextPlay(m_received);
+    m_player.noteOn(channel, note, group, channel);
+    // Don't leave the stamp for the next note if this one was dropped
+    m_dmgr.stampNextPlay(0);
+}
+
+
+void LiveInput::noteOff(int channel, int note)
+{
+    int group;
+    note = m_transform.mapNote(channel, note, group);
+    m_player.noteOff(channel, note);
+}
+
+
+/* Print the number of notes and the input to step latency */
+void LiveInput::report(std::ostream &out)
+{
+    LatencyStats latency = m_dmgr.latency();
+    out << "Notes:   " << m_notes << std::endl;
+    out << "Latency: " << latency << " (" << latency.count << " notes)"
+        << std::endl;
+    out << "Wake-up: " << m_dmgr.wakeups() << std::endl;
+}
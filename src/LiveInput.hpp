@@ -0,0 +1,50 @@
+#ifndef FM_LIVE_INPUT_HPP
+#define FM_LIVE_INPUT_HPP
+
+#include "DriveShards.hpp"
+#include "MidiStream.hpp"
+#include "Player.hpp"
+#include "Transform.hpp"
+#include <ostream>
+#include <string>
+
+/* Plays a raw MIDI byte stream as it comes in, e.g. from a keyboard on
+ * /dev/snd/midi* or a named pipe. The bytes are parsed the moment
+ * read() returns and every note goes straight to the Player, there is
+ * no queue in between. The time from read() returning to the first step
+ * of the note is measured by the drive shards (see stampNextPlay()).
+ *
+ * Notes are treated as coming from track 0, so --transpose and --route
+ * work with 0:channel.
+ */
+class LiveInput : public MidiStream::Handler
+{
+    private:
+    DriveShards &m_dmgr;
+    Player &m_player;
+    Transform const &m_transform;
+    int m_min_velocity;
+    int m_dcount;
+    int m_fd;
+    MidiStream m_stream;
+    // When the bytes that are being parsed arrived
+    long long m_received;
+    long long m_notes;
+
+    LiveInput(LiveInput const &other);
+    LiveInput& operator=(LiveInput const &other);
+
+    public:
+    LiveInput(DriveShards &dmgr, Player &player, Transform const &transform,
+            int min_velocity, int drive_count);
+    ~LiveInput();
+
+    bool open(std::string const &path);
+    void run();
+    void report(std::ostream &out);
+
+    virtual void noteOn(int channel, int note, int velocity);
+    virtual void noteOff(int channel, int note);
+};
+
+#endif
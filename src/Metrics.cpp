@@ -0,0 +1,203 @@
+#include "Metrics.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+MetricsRegion *metrics = 0;
+// There is a play thread per stream, they take turns writing the play
+// part. The drive threads have an engine part each.
+static int play_lock = 0;
+
+
+static void write_begin(unsigned int &seq)
+{
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void write_end(unsigned int &seq)
+{
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+
+static void play_begin()
+{
+    while (__atomic_exchange_n(&play_lock, 1, __ATOMIC_ACQUIRE))
+        ;
+    write_begin(metrics->play.seq);
+}
+
+
+static void play_end()
+{
+    write_end(metrics->play.seq);
+    __atomic_store_n(&play_lock, 0, __ATOMIC_RELEASE);
+}
+
+
+/* Create (or take over) the shared memory segment. Returns false if
+ * that fails, playback works without metrics anyway.
+ */
+bool setup_metrics(int drive_count, int shard_count)
+{
+    int fd = shm_open(METRICS_SHM_NAME, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Metrics: Can't open shared memory: "
+            << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, sizeof(MetricsRegion)) < 0)
+    {
+        std::cerr << "Metrics: Can't resize shared memory: "
+            << std::strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, sizeof(MetricsRegion), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cerr << "Metrics: Can't map shared memory: "
+            << std::strerror(errno) << std::endl;
+        return false;
+    }
+    metrics = static_cast<MetricsRegion*>(map);
+    std::memset(metrics, 0, sizeof(MetricsRegion));
+    metrics->version = METRICS_VERSION;
+    metrics->pid = getpid();
+    metrics->drive_count = drive_count;
+    metrics->shard_count = shard_count < METRICS_MAX_SHARDS
+        ? shard_count : METRICS_MAX_SHARDS;
+    if (shard_count > METRICS_MAX_SHARDS)
+    {
+        std::cerr << "Metrics: Only the ticks of the first "
+            << METRICS_MAX_SHARDS << " of " << shard_count
+            << " shards are published" << std::endl;
+    }
+    if (drive_count > METRICS_MAX_DRIVES)
+    {
+        std::cerr << "Metrics: Only the notes of the first "
+            << METRICS_MAX_DRIVES << " of " << drive_count
+            << " drives are published" << std::endl;
+    }
+    for (int i = 0; i < METRICS_MAX_DRIVES; ++i)
+    {
+        metrics->play.drive_note[i] = -1;
+    }
+    // Readers check the magic last
+    __atomic_store_n(&metrics->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+/* Remove the segment name. The mapping itself stays until the process
+ * exits, so the drive thread may still write to it.
+ */
+void teardown_metrics()
+{
+    if (!metrics) return;
+    shm_unlink(METRICS_SHM_NAME);
+}
+
+
+/* Called by the drive engine of a shard once per tick with the time
+ * (in ns) the tick started after its deadline
+ */
+void metrics_tick(int shard, long long lateness, bool overrun)
+{
+    if (!metrics || shard >= METRICS_MAX_SHARDS) return;
+    EngineMetrics &m = metrics->engine[shard];
+    write_begin(m.seq);
+    ++m.ticks;
+    if (overrun) ++m.tick_overruns;
+    if (lateness > m.worst_tick_lateness) m.worst_tick_lateness = lateness;
+    write_end(m.seq);
+}
+
+
+/* Called by the drive thread of a shard when it wakes up after being
+ * parked
+ */
+void metrics_wake(int shard, long long latency)
+{
+    if (!metrics || shard >= METRICS_MAX_SHARDS) return;
+    EngineMetrics &m = metrics->engine[shard];
+    write_begin(m.seq);
+    ++m.wakeups;
+    if (latency > m.worst_wake_latency) m.worst_wake_latency = latency;
+    write_end(m.seq);
+}
+
+
+/* Called by the play loop for every event it plays */
+void metrics_event(long long lateness)
+{
+    if (!metrics) return;
+    PlayMetrics &m = metrics->play;
+    play_begin();
+    ++m.events_played;
+    if (lateness > m.worst_event_lateness) m.worst_event_lateness = lateness;
+    play_end();
+}
+
+
+/* Called by the play loop when a drive starts playing a note or stops
+ * (note -1)
+ */
+void metrics_note(int drive, int note)
+{
+    if (!metrics || drive >= METRICS_MAX_DRIVES) return;
+    PlayMetrics &m = metrics->play;
+    play_begin();
+    m.drive_note[drive] = note;
+    play_end();
+}
+
+
+/* Called by the play loop when a note is dropped for lack of a free
+ * drive
+ */
+void metrics_dropped()
+{
+    if (!metrics) return;
+    PlayMetrics &m = metrics->play;
+    play_begin();
+    ++m.notes_dropped;
+    play_end();
+}
+
+
+template <typename T>
+static void read_part(T const &part, T &copy)
+{
+    unsigned int before, after;
+    do
+    {
+        before = __atomic_load_n(&part.seq, __ATOMIC_ACQUIRE);
+        std::memcpy(&copy, &part, sizeof(T));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&part.seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+
+void metrics_snapshot(MetricsRegion const *region, MetricsRegion &copy)
+{
+    copy.magic = __atomic_load_n(&region->magic, __ATOMIC_ACQUIRE);
+    copy.version = region->version;
+    copy.pid = region->pid;
+    copy.drive_count = region->drive_count;
+    copy.shard_count = region->shard_count;
+    for (int s = 0; s < METRICS_MAX_SHARDS; ++s)
+    {
+        read_part(region->engine[s], copy.engine[s]);
+    }
+    read_part(region->play, copy.play);
+}
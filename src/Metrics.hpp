@@ -0,0 +1,69 @@
+#ifndef FM_METRICS_HPP
+#define FM_METRICS_HPP
+
+/* Live metrics, published in a POSIX shared memory segment so that
+ * floppymusic-stat (or anything else) can watch a running show.
+ *
+ * The segment has an engine part per drive shard, each written only by
+ * the drive thread of its shard, and a play part written by the play
+ * thread(s). Readers add up the engine parts of all shards. Each part
+ * is protected by its own seqlock: the writer makes seq odd before and
+ * even again after an update, readers retry as long as seq is odd or
+ * changed while they copied the data. Writers never wait for readers,
+ * and the drive threads never wait for each other.
+ *
+ * Bump METRICS_VERSION whenever the layout changes.
+ */
+
+#define METRICS_SHM_NAME "/floppymusic"
+#define METRICS_MAGIC 0x464D4D54 // "FMMT"
+#define METRICS_VERSION 3
+#define METRICS_MAX_DRIVES 32
+#define METRICS_MAX_SHARDS 16
+
+struct EngineMetrics
+{
+    unsigned int seq;
+    unsigned long long ticks;
+    unsigned long long tick_overruns;
+    long long worst_tick_lateness; // nanoseconds
+    unsigned long long wakeups; // after the drive thread was parked
+    long long worst_wake_latency; // nanoseconds
+};
+
+struct PlayMetrics
+{
+    unsigned int seq;
+    unsigned long long events_played;
+    unsigned long long notes_dropped;
+    long long worst_event_lateness; // nanoseconds
+    int drive_note[METRICS_MAX_DRIVES]; // -1 if the drive is silent
+};
+
+struct MetricsRegion
+{
+    unsigned int magic;
+    unsigned int version;
+    int pid;
+    int drive_count;
+    int shard_count;
+    EngineMetrics engine[METRICS_MAX_SHARDS];
+    PlayMetrics play;
+};
+
+// NULL if metrics are disabled
+extern MetricsRegion *metrics;
+
+bool setup_metrics(int drive_count, int shard_count);
+void teardown_metrics();
+
+void metrics_tick(int shard, long long lateness, bool overrun);
+void metrics_wake(int shard, long long latency);
+void metrics_event(long long lateness);
+void metrics_note(int drive, int note);
+void metrics_dropped();
+
+// Reader side, copies a consistent snapshot of the region
+void metrics_snapshot(MetricsRegion const *region, MetricsRegion &copy);
+
+#endif
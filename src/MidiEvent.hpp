@@ -30,8 +30,9 @@ class MidiEvent
 
     int relative_ticks;
     int absolute_ticks;
-    int relative_musec;
-    int absolute_musec;
+    // Nanoseconds, relative to the previous event and to the start
+    long long relative_nsec;
+    long long absolute_nsec;
 
     static std::string nameForType(EventType t);
 };
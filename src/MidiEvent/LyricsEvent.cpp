@@ -1,8 +1,17 @@
 #include "LyricsEvent.hpp"
 
+/* Carriage returns in the lyrics are turned into newlines right away,
+ * so there's nothing left to do when they are printed.
+ */
 LyricsEvent::LyricsEvent(std::string text) :
     m_text(text)
-{}
+{
+    size_t it = 0;
+    while ((it = m_text.find('\r', it)) != std::string::npos)
+    {
+        m_text[it] = '\n';
+    }
+}
 
 
 LyricsEvent::~LyricsEvent()
@@ -19,3 +28,10 @@ std::string LyricsEvent::getText() const
 {
     return m_text;
 }
+
+
+/* The text without a copy, valid as long as the event lives */
+char const *LyricsEvent::c_str() const
+{
+    return m_text.c_str();
+}
@@ -14,6 +14,7 @@ class LyricsEvent : public MidiEvent
     virtual ~LyricsEvent();
     virtual EventType type() const;
     std::string getText() const;
+    char const *c_str() const;
 };
 
 #endif
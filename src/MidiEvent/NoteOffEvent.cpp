@@ -1,7 +1,8 @@
 #include "NoteOffEvent.hpp"
 
 NoteOffEvent::NoteOffEvent(int channel, int number) :
-    m_channel(channel), m_number(number), muted(false)
+    m_channel(channel), m_number(number), muted(false),
+    source(channel), group(-1)
 {}
 
 
@@ -31,3 +32,9 @@ void NoteOffEvent::setChannel(int c)
 {
     m_channel = c;
 }
+
+
+void NoteOffEvent::setNote(int n)
+{
+    m_number = n;
+}
@@ -1,7 +1,8 @@
 #include "NoteOnEvent.hpp"
 
 NoteOnEvent::NoteOnEvent(int channel, int number, int velocity) :
-    m_channel(channel), m_number(number), m_velocity(velocity), muted(false)
+    m_channel(channel), m_number(number), m_velocity(velocity), muted(false),
+    source(channel), group(-1)
 {}
 
 
@@ -37,3 +38,9 @@ void NoteOnEvent::setChannel(int c)
 {
     m_channel = c;
 }
+
+
+void NoteOnEvent::setNote(int n)
+{
+    m_number = n;
+}
@@ -19,7 +19,13 @@ class NoteOnEvent : public MidiEvent
     int getVelocity() const;
 
     void setChannel(int c);
+    void setNote(int n);
     bool muted;
+    // (track_nr << 4) | channel_nr of the original channel, see
+    // MidiFile::mergedTracks()
+    int source;
+    // Drive group that should play the note, -1 for any drive
+    int group;
 };
 
 #endif
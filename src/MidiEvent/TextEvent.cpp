@@ -19,3 +19,10 @@ std::string TextEvent::getText() const
 {
     return m_text;
 }
+
+
+/* The text without a copy, valid as long as the event lives */
+char const *TextEvent::c_str() const
+{
+    return m_text.c_str();
+}
@@ -14,6 +14,7 @@ class TextEvent : public MidiEvent
     virtual ~TextEvent();
     virtual EventType type() const;
     std::string getText() const;
+    char const *c_str() const;
 };
 
 #endif
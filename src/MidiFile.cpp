@@ -1,5 +1,7 @@
 #include "MidiFile.hpp"
 #include "MidiEvents.hpp"
+#include "TempoMap.hpp"
+#include "Trace.hpp"
 #include <cstring>
 #include <iostream>
 
@@ -21,17 +23,18 @@ MidiFile::~MidiFile()
 
 
 /* Read the midi from the given input stream. Returns a boolean
- * indicating if the file has been succesfully read.
+ * indicating if the file has been succesfully read, what was wrong
+ * with it is written to errors.
  */
-bool MidiFile::read(std::istream &inp)
+bool MidiFile::read(std::istream &inp, std::ostream &errors)
 {
     unsigned char buffer[4];
     char *sbuffer = reinterpret_cast<char*>(buffer);
     // Check if this is a valid midi file
     inp.read(sbuffer, 4);
-    if (std::memcmp(buffer, MIDI_HEADER_ID, 4))
+    if (inp.gcount() != 4 || std::memcmp(buffer, MIDI_HEADER_ID, 4))
     {
-        std::cerr << "MIDI: Invalid midi file, wrong header id (expected "
+        errors << "MIDI: Invalid midi file, wrong header id (expected "
             << MIDI_HEADER_ID << ")" << std::endl;
         return false;
     }
@@ -45,7 +48,7 @@ bool MidiFile::read(std::istream &inp)
         | buffer[3];
     if (chunk_size != 6)
     {
-        std::cerr << "MIDI: Invalid midi file, wrong header size ("
+        errors << "MIDI: Invalid midi file, wrong header size ("
             << chunk_size << " instead of 6)" << std::endl;
         return false;
     }
@@ -60,7 +63,7 @@ bool MidiFile::read(std::istream &inp)
         case 2:
             break;
         default:
-            std::cerr << "MIDI: Invalid format type ("
+            errors << "MIDI: Invalid format type ("
                 << m_format_type << ")" << std::endl;
             return false;
     }
@@ -72,24 +75,42 @@ bool MidiFile::read(std::istream &inp)
     // Read the time division
     inp.read(sbuffer, 2);
     m_time_division = buffer[0] << 8 | buffer[1];
+    if (!inp.good())
+    {
+        errors << "MIDI: Invalid midi file, header is truncated"
+            << std::endl;
+        return false;
+    }
+    if ((m_time_division & 0x7FFF) == 0
+            || ((m_time_division & 0x8000) && (m_time_division & 0xFF) == 0))
+    {
+        errors << "MIDI: Invalid time division (" << m_time_division
+            << ")" << std::endl;
+        return false;
+    }
 
     // Header completed, read the tracks
     MidiTrack *track;
     for (int t_nr = 0; t_nr < m_track_count; ++t_nr)
     {
-        track = MidiTrack::read_track(t_nr, inp);
+        track = MidiTrack::read_track(t_nr, inp, errors);
         if (!track)
         {
             return false;
         }
         m_tracks.push_back(track);
     }
+    if (m_tracks.empty())
+    {
+        return true;
+    }
+    // Tempo information should be stored on the first track and
+    // (au contraire to what I thought) applied to every track.
+    TempoMap tempo(m_time_division, m_tracks[0]);
     for (TrackList::iterator tr = m_tracks.begin();
             tr != m_tracks.end(); ++tr)
     {
-        // Tempo information should be stored on the first track and
-        // (au contraire to what I thought) applied to every track.
-        (*tr)->calc_realtimes(m_time_division, m_tracks[0]);
+        (*tr)->calc_realtimes(tempo);
     }
 
     return true;
@@ -135,9 +156,13 @@ struct _track
  * remaining bits are the track:
  *      (track_nr << 4) | channel_nr
  *
+ * Every channel of every track gets its own channel number in the
+ * merged track, the original combination is kept in the source field
+ * of the note events.
  */
 EventList MidiFile::mergedTracks(std::set<int> muted)
 {
+    TRACE_SCOPE("merge tracks");
     EventList result;
     typedef std::vector<_track> trackv;
     trackv tracks;
@@ -171,7 +196,7 @@ EventList MidiFile::mergedTracks(std::set<int> muted)
             {
                 exhausted = false;
                 
-                if (min_event == 0 || t->t->at(t->pos)->absolute_musec < min_event->absolute_musec)
+                if (min_event == 0 || t->t->at(t->pos)->absolute_nsec < min_event->absolute_nsec)
                 {
                     min_event = t->t->at(t->pos);
                     min_track = &(*t);
@@ -186,6 +211,7 @@ EventList MidiFile::mergedTracks(std::set<int> muted)
             NoteOnEvent *e = dynamic_cast<NoteOnEvent*>(min_event);
             combination = min_track->index << 4 | e->getChannel();
             e->muted = (muted.find(combination) != muted.end());
+            e->source = combination;
             if (chanmap.find(combination) == chanmap.end())
             {
                 chanmap[combination] = nextchan;
@@ -198,6 +224,7 @@ EventList MidiFile::mergedTracks(std::set<int> muted)
             NoteOffEvent *e = dynamic_cast<NoteOffEvent*>(min_event);
             combination = min_track->index << 4 | e->getChannel();
             e->muted = (muted.find(combination) != muted.end());
+            e->source = combination;
             if (chanmap.find(combination) == chanmap.end())
             {
                 chanmap[combination] = nextchan;
@@ -208,21 +235,21 @@ EventList MidiFile::mergedTracks(std::set<int> muted)
         result.push_back(min_event);
     }
     int dticks;
-    double dmusec;
+    long long dnsec;
     for (size_t i = 0; i < result.size(); ++i)
     {
         if (i == 0)
         {
             dticks = result[i]->absolute_ticks;
-            dmusec = result[i]->absolute_musec;
+            dnsec = result[i]->absolute_nsec;
         }
         else
         {
             dticks = result[i]->absolute_ticks - result[i-1]->absolute_ticks;
-            dmusec = result[i]->absolute_musec - result[i-1]->absolute_musec;
+            dnsec = result[i]->absolute_nsec - result[i-1]->absolute_nsec;
         }
         result[i]->relative_ticks = dticks;
-        result[i]->relative_musec = dmusec;
+        result[i]->relative_nsec = dnsec;
     }
     return result;
 }
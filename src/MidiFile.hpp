@@ -2,7 +2,7 @@
 #define FM_MIDI_FILE_HPP
 
 #include "MidiTrack.hpp"
-#include <istream>
+#include <iostream>
 #include <map>
 #include <set>
 
@@ -19,7 +19,7 @@ class MidiFile
     public:
     MidiFile();
     ~MidiFile();
-    bool read(std::istream &inp);
+    bool read(std::istream &inp, std::ostream &errors = std::cerr);
 
     MidiTrack* getTrack(int n);
     int getTrackCount() const;
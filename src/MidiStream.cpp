@@ -0,0 +1,117 @@
+#include "MidiStream.hpp"
+
+
+MidiStream::Handler::~Handler()
+{}
+
+
+MidiStream::MidiStream(Handler &handler) :
+    m_handler(handler)
+{
+    reset();
+}
+
+
+/* Forget everything about the current message and the running status */
+void MidiStream::reset()
+{
+    m_status = 0;
+    m_running = false;
+    m_sysex = false;
+    m_count = 0;
+    m_expected = 0;
+}
+
+
+/* Number of data bytes that follow a status byte */
+static int data_length(int status)
+{
+    switch (status & 0xF0)
+    {
+        case 0xC0: // Program change
+        case 0xD0: // Channel pressure
+            return 1;
+        case 0xF0:
+            switch (status)
+            {
+                case 0xF1: // MTC quarter frame
+                case 0xF3: // Song select
+                    return 1;
+                case 0xF2: // Song position
+                    return 2;
+                default:
+                    return 0;
+            }
+        default:
+            return 2;
+    }
+}
+
+
+void MidiStream::status(int byte)
+{
+    if (byte >= 0xF8)
+    {
+        // Real time, doesn't even interrupt a running message
+        return;
+    }
+    m_sysex = byte == 0xF0;
+    m_status = byte;
+    m_count = 0;
+    m_expected = data_length(byte);
+    // System messages cancel the running status
+    m_running = byte < 0xF0;
+    if (byte >= 0xF0 && m_expected == 0)
+    {
+        m_status = 0;
+    }
+}
+
+
+/* Pass a complete message on to the handler */
+void MidiStream::dispatch()
+{
+    int channel = m_status & 0x0F;
+    switch (m_status & 0xF0)
+    {
+        case 0x90:
+            if (m_data[1] > 0)
+            {
+                m_handler.noteOn(channel, m_data[0], m_data[1]);
+                break;
+            }
+            // NOTE ON with velocity 0 is a NOTE OFF
+            // fall through
+        case 0x80:
+            m_handler.noteOff(channel, m_data[0]);
+            break;
+    }
+}
+
+
+/* Feed the next length bytes of the stream to the parser */
+void MidiStream::push(unsigned char const *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        int byte = data[i];
+        if (byte & 0x80)
+        {
+            status(byte);
+            continue;
+        }
+        if (m_sysex || m_status == 0)
+        {
+            // SysEx payload or data without a status, skip it
+            continue;
+        }
+        m_data[m_count++] = byte;
+        if (m_count < m_expected) continue;
+        dispatch();
+        m_count = 0;
+        if (!m_running)
+        {
+            m_status = 0;
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef FM_MIDI_STREAM_HPP
+#define FM_MIDI_STREAM_HPP
+
+#include <cstddef>
+
+/* Incremental parser for a raw MIDI byte stream (a serial port, a
+ * /dev/snd/midi* device, a named pipe, ...). Unlike MidiTrack it doesn't
+ * need a whole chunk in memory: bytes are pushed in as they arrive, in
+ * pieces of any size, and every complete note message is handed to the
+ * Handler right away.
+ *
+ * Running status is supported, real time messages (clock, active
+ * sensing, ...) may appear anywhere and are ignored, SysEx and system
+ * common messages are skipped.
+ */
+class MidiStream
+{
+    public:
+    class Handler
+    {
+        public:
+        virtual ~Handler();
+        virtual void noteOn(int channel, int note, int velocity) = 0;
+        virtual void noteOff(int channel, int note) = 0;
+    };
+
+    private:
+    Handler &m_handler;
+    // Status of the message being read, 0 if data bytes are to be
+    // ignored
+    int m_status;
+    bool m_running;
+    bool m_sysex;
+    int m_data[2];
+    int m_count;
+    int m_expected;
+
+    MidiStream(MidiStream const &other);
+    MidiStream& operator=(MidiStream const &other);
+
+    void status(int byte);
+    void dispatch();
+
+    public:
+    MidiStream(Handler &handler);
+
+    void push(unsigned char const *data, size_t length);
+    void reset();
+};
+
+#endif
@@ -1,50 +1,63 @@
 #include "MidiTrack.hpp"
 #include "MidiEvents.hpp"
+#include "TempoMap.hpp"
+#include "Trace.hpp"
 #include <cstring>
 #include <iostream>
 
 static const char MIDI_TRACK_HEADER_ID[] = {'M', 'T', 'r', 'k', 0};
 
 
-#define IS_META(event) (event.event_type == 0xF && event.channel == 0xF)
-#define IS_SYSEX(event) (event.event_type == 0xF && \
-        (event.channel == 0x0 || event.channel == 0x7))
+/* A cursor over the bytes of a track chunk. Every read checks the
+ * bounds first and fails instead of reading past the end of the chunk,
+ * so a corrupted or hostile file can't make us read foreign memory.
+ */
+struct ByteCursor
+{
+    unsigned char const *pos;
+    unsigned char const *end;
+};
 
 
-/* Extracts a variable length value from a char array, starting at *inp
- * and copying the relevant bytes to *buffer. Reads at most max bytes
- * and returns the number of bytes used.
- */
-static int read_varlen(unsigned char buffer[], unsigned char const *inp, int max)
+static bool read_byte(ByteCursor &cur, unsigned int &out)
 {
-    int i = 0;
-    do
-    {
-        if (i >= max)
-        {
-            return -i;
-        }
-        buffer[i] = inp[i] & 0x7F;
-        ++i;
-    } while (inp[i-1] & 0x80);
-    return i;
+    if (cur.pos >= cur.end) return false;
+    out = *cur.pos++;
+    return true;
+}
+
+
+/* Reads a data byte (one without the top bit set) */
+static bool read_data(ByteCursor &cur, unsigned int &out)
+{
+    return read_byte(cur, out) && !(out & 0x80);
+}
+
+
+static bool skip(ByteCursor &cur, unsigned int count)
+{
+    if ((unsigned int)(cur.end - cur.pos) < count) return false;
+    cur.pos += count;
+    return true;
 }
 
 
-/* Converts a variable length value (stored in *buffer) that has length
- * num. Returns the value.
+/* Decodes a variable length value in a single pass. A varlen has at
+ * most 4 bytes, each byte carries 7 bits of the value and the top bit
+ * tells if another byte follows:
+ *      0x81 0x00 (varlen) = 0x80 (normal int)
  */
-static int varlen_to_int(unsigned char const buffer[], int num)
+static bool read_varlen(ByteCursor &cur, unsigned int &out)
 {
-    int res = 0;
-    for (int i = 0; i < num; ++i)
+    unsigned int byte;
+    out = 0;
+    for (int i = 0; i < 4; ++i)
     {
-        // since the first bit is unused we only have to shift by 7 instead of
-        // 8 here:
-        // 0x81 0x00 (varlen) = 0x80 (normal int)
-        res |= buffer[i] << ((num - i - 1) * 7);
+        if (!read_byte(cur, byte)) return false;
+        out = (out << 7) | (byte & 0x7F);
+        if (!(byte & 0x80)) return true;
     }
-    return res;
+    return false;
 }
 
 
@@ -74,250 +87,265 @@ void MidiTrack::insert(MidiEvent *event)
  *
  * Returns either a pointer to a MidiTrack or NULL if errors occured.
  */
-MidiTrack* MidiTrack::read_track(int t_nr, std::istream &inp)
+MidiTrack* MidiTrack::read_track(int t_nr, std::istream &inp,
+        std::ostream &errors)
 {
+    TRACE_SCOPE("read track");
     unsigned char buffer[4] = {0, 0, 0, 0};
     char *sbuffer = reinterpret_cast<char*>(buffer);
-    MidiTrack* track = new MidiTrack;
-    if (!track)
-    {
-        std::cerr << "Can't allocate enough space for MidiTrack" << std::endl;
-        return 0;
-    }
     inp.read(sbuffer, 4);
-    if (std::memcmp(buffer, MIDI_TRACK_HEADER_ID, 4))
+    if (inp.gcount() != 4 || std::memcmp(buffer, MIDI_TRACK_HEADER_ID, 4))
     {
-        std::cerr << "MIDI: Invalid midi track " << t_nr
+        errors << "MIDI: Invalid midi track " << t_nr
             << ", invalid starting bytes" << std::endl;
-        delete track;
         return 0;
     }
 
     inp.read(sbuffer, 4);
-    track->m_chunk_size = buffer[0] << 24
+    if (inp.gcount() != 4)
+    {
+        errors << "MIDI: Track " << t_nr << " is truncated" << std::endl;
+        return 0;
+    }
+    unsigned int chunk_size = buffer[0] << 24
         | buffer[1] << 16
         | buffer[2] << 8
         | buffer[3];
 
-    // Position in the track (in bytes since the track start)
-    int i = 0;
-    // Number of bytes consumed by read_varlen
-    int rv_read;
-    int last_event = 0;
-    int delta_time = 0;
-    int event_type = 0;
-    int channel = 0;
-    int ticks = 0;
+    // Don't trust the chunk size blindly, a corrupted header shouldn't
+    // make us allocate gigabytes before noticing that the file is
+    // much shorter.
+    std::streampos here = inp.tellg();
+    if (here != std::streampos(-1))
+    {
+        inp.seekg(0, std::ios::end);
+        std::streampos stream_end = inp.tellg();
+        inp.seekg(here);
+        if (stream_end - here < (std::streamoff)chunk_size)
+        {
+            errors << "MIDI: Track " << t_nr << " claims to have "
+                << chunk_size << " bytes but the file is shorter, maybe "
+                "the header is corrupted?" << std::endl;
+            return 0;
+        }
+    }
 
     // To make it easier (and faster) we will just read the remaining
-    // bytes of the file into memory.
-    unsigned char *file_content = new unsigned char[track->m_chunk_size];
-    if (file_content == NULL)
+    // bytes of the track into memory.
+    std::vector<unsigned char> file_content(chunk_size);
+    if (chunk_size > 0)
     {
-        std::cerr << "MIDI: FILE_CONTENT ALLOCATION FAILED, "
-            "WHERE IS YOUR GOD NOW" << std::endl;
-        delete track;
-        return 0;
+        inp.read(reinterpret_cast<char*>(&file_content[0]), chunk_size);
     }
-    char *sfile_content = reinterpret_cast<char*>(file_content);
-    inp.read(sfile_content, track->m_chunk_size);
-    if (inp.gcount() != (int)track->m_chunk_size)
+    if (inp.gcount() != (std::streamsize)chunk_size)
     {
-        std::cerr << "MIDI: Couldn't read all " << track->m_chunk_size
+        errors << "MIDI: Couldn't read all " << chunk_size
             << " bytes, maybe the header is corrupted?" << std::endl;
-        goto fail;
+        return 0;
     }
+    return from_buffer(t_nr,
+            chunk_size ? &file_content[0] : 0, chunk_size, errors);
+}
+
 
-    while (i < track->m_chunk_size)
+/* Decode the events of a track from the chunk data (everything after
+ * the MTrk header and the chunk size). Only the events that are needed
+ * for playback (notes, text, lyrics and tempo changes) are kept,
+ * everything else is skipped without allocating anything. The
+ * relative_ticks of the kept events include the delta times of the
+ * skipped ones.
+ *
+ * Returns either a pointer to a MidiTrack or NULL if the data is
+ * invalid.
+ */
+MidiTrack* MidiTrack::from_buffer(int t_nr, unsigned char const *data,
+        unsigned int size, std::ostream &errors)
+{
+    MidiTrack* track = new MidiTrack;
+    track->m_chunk_size = size;
+
+    ByteCursor cur = {data, data + size};
+    char const *sdata = reinterpret_cast<char const*>(data);
+    // Status byte of the last channel message, 0 if running status
+    // isn't possible right now
+    unsigned int running = 0;
+    unsigned int delta_time, status, data1, data2;
+    unsigned int meta_type, length;
+    long ticks = 0;
+    long last_ticks = 0;
+    char const *error = 0;
+
+    while (cur.pos < cur.end)
     {
         MidiEvent* event = 0;
-        rv_read = read_varlen(buffer, file_content + i, 4);
-        if (rv_read < 0)
+        if (!read_varlen(cur, delta_time))
         {
-            std::cerr << "MIDI: Varlength data too much in track " << t_nr
-                << std::endl;
-            goto fail;
+            error = "invalid delta time";
+            break;
         }
-        i += rv_read;
-        delta_time = varlen_to_int(buffer, rv_read);
         ticks += delta_time;
 
-        event_type = (file_content[i] & 0xF0) >> 4;
-        channel = file_content[i] & 0x0F;
-        ++i;
-
-category:        
-        if (event_type == 0x8)
+        if (!read_byte(cur, status))
         {
-            event = new NoteOffEvent(channel, file_content[i]);
-            i += 2;
+            error = "missing event";
+            break;
         }
-        else if (event_type == 0x9)
+        if (!(status & 0x80))
         {
-            if (file_content[i+1] == 0)
-            {
-                // NOTE ON with velocity of 0 should be treated as NOTE OFF
-                event = new NoteOffEvent(channel, file_content[i]);
-            }
-            else
+            // Running status, the byte we just read is the first data
+            // byte of a message with the previous status
+            if (!running)
             {
-                event = new NoteOnEvent(channel, file_content[i], file_content[i+1]);
+                error = "data byte without status";
+                break;
             }
-            i += 2;
+            data1 = status;
+            status = running;
         }
-        else if (event_type == 0xC || event_type == 0xD)
+        else if (status < 0xF0)
         {
-            event = new GenericEvent();
-            ++i;
+            if (!read_data(cur, data1))
+            {
+                error = "truncated channel message";
+                break;
+            }
+            running = status;
         }
-        else if (!(event_type & 0x8))
+
+        if (status < 0xF0)
         {
-            // Reuse last event
-            event_type = last_event >> 8;
-            channel = last_event & 0xF;
-            --i;
-            goto category;
+            unsigned int channel = status & 0x0F;
+            switch (status >> 4)
+            {
+                case 0x8:
+                    if (!read_data(cur, data2)) goto truncated;
+                    event = new NoteOffEvent(channel, data1);
+                    break;
+                case 0x9:
+                    if (!read_data(cur, data2)) goto truncated;
+                    if (data2 == 0)
+                    {
+                        // NOTE ON with velocity of 0 should be treated
+                        // as NOTE OFF
+                        event = new NoteOffEvent(channel, data1);
+                    }
+                    else
+                    {
+                        event = new NoteOnEvent(channel, data1, data2);
+                    }
+                    break;
+                case 0xC:
+                case 0xD:
+                    // Program change and channel aftertouch only have
+                    // a single data byte
+                    break;
+                default:
+                    if (!read_data(cur, data2)) goto truncated;
+                    break;
+            }
         }
-        else if (event_type == 0xF && channel == 0xF)
+        else if (status == 0xFF)
         {
             // Meta event
-            unsigned int meta_type = file_content[i]; ++i;
-            unsigned int meta_length = file_content[i]; ++i;
+            running = 0;
+            if (!read_byte(cur, meta_type) || !read_varlen(cur, length)
+                    || (unsigned int)(cur.end - cur.pos) < length)
+            {
+                error = "truncated meta event";
+                break;
+            }
+            char const *text = sdata + (cur.pos - data);
             switch (meta_type)
             {
                 case 0x01:
                     // Text event
-                    event = new TextEvent(std::string(
-                                sfile_content + i, meta_length));
+                    event = new TextEvent(std::string(text, length));
                     break;
                 case 0x05:
                     // Lyrics
-                    event = new LyricsEvent(std::string(
-                                sfile_content + i, meta_length));
+                    event = new LyricsEvent(std::string(text, length));
                     break;
                 case 0x2F:
-                    // End of track:
-                    goto end;
+                    // End of track
+                    return track;
                 case 0x51:
                     // Set tempo
-                    event = new TempoEvent(file_content[i] << 16 |
-                            file_content[i+1] << 8 |
-                            file_content[i]);
+                    if (length < 3)
+                    {
+                        error = "invalid tempo event";
+                        goto fail;
+                    }
+                    event = new TempoEvent(cur.pos[0] << 16 |
+                            cur.pos[1] << 8 |
+                            cur.pos[2]);
                     break;
                 default:
-                    event = new GenericEvent();
                     break;
             }
-            i += meta_length;
+            cur.pos += length;
         }
-        else if (event_type == 0xF && (channel == 0x0 || channel == 0x7))
+        else if (status == 0xF0 || status == 0xF7)
         {
             // SysEx event
-            rv_read = read_varlen(buffer, file_content + i, 4);
-            if (rv_read < 0)
+            running = 0;
+            if (!read_varlen(cur, length) || !skip(cur, length))
             {
-                std::cerr << "Invalid SysEx event in track " << t_nr
-                    << std::endl;
-                goto fail;
+                error = "invalid SysEx event";
+                break;
             }
-            i += rv_read;
-            i += varlen_to_int(buffer, rv_read);
-            event = new GenericEvent();
         }
         else
         {
-            event = new GenericEvent();
-            i += 2;
+            // System common and realtime messages are not supposed to
+            // be in a file, but at least we know how long they are.
+            // Realtime messages (0xF8 and up) don't touch the running
+            // status.
+            if (status < 0xF8) running = 0;
+            length = (status == 0xF2) ? 2
+                : (status == 0xF1 || status == 0xF3) ? 1 : 0;
+            if (!skip(cur, length)) goto truncated;
         }
 
-        last_event = (event_type << 8) | channel;
-        if (!event)
+        if (event)
         {
-            std::cerr << "Event allocation failed" << std::endl;
-            goto fail;
+            event->relative_ticks = ticks - last_ticks;
+            event->absolute_ticks = ticks;
+            last_ticks = ticks;
+            track->m_events.push_back(event);
         }
-        event->relative_ticks = delta_time;
-        event->absolute_ticks = ticks;
-        track->m_events.push_back(event);
+        continue;
 
+truncated:
+        error = "truncated event";
+        break;
     }
 
-end:
-    delete[] file_content;
-    return track;
-
+    if (!error)
+    {
+        return track;
+    }
 fail:
-    delete[] file_content;
+    errors << "MIDI: Track " << t_nr << " is corrupted (" << error
+        << " at byte " << (cur.pos - data) << ")" << std::endl;
     delete track;
     return 0;
 }
 
 
-/* Takes the microseconds per quarter note, the time division of the
- * MIDI header and the number of ticks and returns... the ticks
- * converted to real time microseconds!
- *
- * Only works with time divisions of ond type yet (though I haven't
- * found a MIDI yet that didn't use this type)
- */
-static int calc_musec(double mpqn, int time_div, long ticks)
-{
-    if ((time_div & 0x8000) == 0)
-    {
-        // time division is in ticks per quarter note, header.tempo contains
-        // the microseconds per quarter note
-        return (double)mpqn * ticks / time_div;
-    }
-    return -1;
-}
-
-
-/* Advances the given iterator to the next tempo change event
- */
-static void find_tempo_event(EventList::const_iterator &tit,
-        EventList::const_iterator end)
-{
-    ++tit;
-    while (tit != end && (*tit)->type() != Event_Tempo)
-    {
-        ++tit;
-    }
-}
-
-
-/* Calculate absolute_musec and relative_musec for (this) using
- * timeline as the track containing the tempo change events
+/* Calculate absolute_nsec and relative_nsec for (this) using the tempo
+ * map of the file. The relative times are the differences of the
+ * absolute ones, so they add up exactly.
  */
-void MidiTrack::calc_realtimes(int time_div, MidiTrack const *timeline)
+void MidiTrack::calc_realtimes(TempoMap const &tempo)
 {
-    long abs_musec = 0;
-    static TempoEvent default_tempo = TempoEvent(BPM_TO_MPQN(120));
-    TempoEvent const *tempo = &default_tempo;
-    EventList::const_iterator timeline_it = timeline->m_events.begin();
-    EventList::const_iterator timeline_end = timeline->m_events.end();
-
-    EventList::iterator event = m_events.begin();
-    EventList::iterator end = m_events.end();
-    
-    while (event != end)
+    TRACE_SCOPE("calc_realtimes");
+    long long previous = 0;
+    for (EventList::iterator event = m_events.begin();
+            event != m_events.end(); ++event)
     {
-        find_tempo_event(timeline_it, timeline_end);
-        while (event != end &&
-                // either there is no further tempo change
-                (timeline_it == timeline_end ||
-                // or the next tempo change is still in the future
-                 (*event)->absolute_ticks < (*timeline_it)->absolute_ticks))
-        {
-            (*event)->relative_musec = calc_musec(tempo->getMpqn(), time_div, (*event)->relative_ticks);
-            //std::cerr << (*event)->relative_musec << std::endl;
-            abs_musec += (*event)->relative_musec;
-            (*event)->absolute_musec = abs_musec;
-            ++event;
-        }
-        if (timeline_it != timeline_end)
-        {
-            tempo = dynamic_cast<TempoEvent*>(*timeline_it);
-        }
+        (*event)->absolute_nsec = tempo.nsec((*event)->absolute_ticks);
+        (*event)->relative_nsec = (*event)->absolute_nsec - previous;
+        previous = (*event)->absolute_nsec;
     }
 }
 
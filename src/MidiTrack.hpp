@@ -3,15 +3,18 @@
 
 #include "MidiEvent.hpp"
 #include <istream>
+#include <ostream>
 #include <vector>
 
 typedef std::vector<MidiEvent*> EventList;
 
+class TempoMap;
+
 class MidiTrack
 {
     private:
     EventList m_events;
-    int m_chunk_size;
+    unsigned int m_chunk_size;
 
     MidiTrack(MidiTrack const &other);
     MidiTrack& operator=(MidiTrack const &other);
@@ -21,9 +24,12 @@ class MidiTrack
     ~MidiTrack();
 
     void insert(MidiEvent *event);
-    void calc_realtimes(int time_div, MidiTrack const *timeline);
+    void calc_realtimes(TempoMap const &tempo);
 
-    static MidiTrack* read_track(int t_nr, std::istream &inp);
+    static MidiTrack* read_track(int t_nr, std::istream &inp,
+            std::ostream &errors);
+    static MidiTrack* from_buffer(int t_nr, unsigned char const *data,
+            unsigned int size, std::ostream &errors);
 
     EventList::iterator begin();
     EventList::iterator end();
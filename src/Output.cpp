@@ -0,0 +1,20 @@
+#include "Output.hpp"
+
+Output::~Output()
+{}
+
+
+void NullOutput::setup(Drive const &drive)
+{}
+
+
+void NullOutput::direction(Drive const &drive, bool forward)
+{}
+
+
+void NullOutput::step(Drive const &drive)
+{}
+
+
+void NullOutput::flush()
+{}
@@ -0,0 +1,36 @@
+#ifndef FM_OUTPUT_HPP
+#define FM_OUTPUT_HPP
+
+struct Drive;
+
+/* An Output is where the direction and step signals of the drives end
+ * up. The DriveManager calls step() for every drive that has to step
+ * in a tick and flush() once at the end of the tick, so an output can
+ * send all pulses of a tick at once.
+ */
+class Output
+{
+    public:
+    virtual ~Output();
+
+    // Prepare the pins of a drive, called once per drive
+    virtual void setup(Drive const &drive) = 0;
+    virtual void direction(Drive const &drive, bool forward) = 0;
+    virtual void step(Drive const &drive) = 0;
+    virtual void flush() = 0;
+};
+
+
+/* Output that goes nowhere, for running the drive engine without any
+ * hardware
+ */
+class NullOutput : public Output
+{
+    public:
+    virtual void setup(Drive const &drive);
+    virtual void direction(Drive const &drive, bool forward);
+    virtual void step(Drive const &drive);
+    virtual void flush();
+};
+
+#endif
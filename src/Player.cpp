@@ -0,0 +1,196 @@
+#include "Player.hpp"
+#include "Console.hpp"
+#include "Metrics.hpp"
+#include "MidiEvents.hpp"
+#include <cmath>
+
+
+#define MASK(channel, note) (((channel) << 7) | ((note) & 0x7F))
+
+
+Player::Player(DriveControl &dmgr, DriveList const &drives,
+        double drop_factor, bool lyrics) :
+    m_dmgr(dmgr), m_notes(drives.size(), -1), m_playing(8, -1),
+    m_dcount(drives.size()), m_lyrics(lyrics), m_dropped(PLAYER_TRACKS << 4, 0)
+{
+    while (m_playing.size() < 2 * drives.size())
+    {
+        m_playing.resize(2 * m_playing.size(), -1);
+    }
+    for (DriveList::const_iterator d = drives.begin();
+            d != drives.end(); ++d)
+    {
+        m_groups.push_back(d->group);
+    }
+    // Equal temperament, A4 (note 69) is 440 Hz
+    for (int n = 0; n < 128; ++n)
+    {
+        m_frequencies[n] = 440.0 * std::pow(2.0, (n - 69) / 12.0)
+            / drop_factor;
+    }
+}
+
+
+void Player::handle(MidiEvent *event)
+{
+    if (event->type() == Event_Note_Off)
+    {
+        NoteOffEvent* e = dynamic_cast<NoteOffEvent*>(event);
+        if (e->muted) return;
+        noteOff(e->getChannel(), e->getNote());
+    }
+    else if (event->type() == Event_Note_On)
+    {
+        NoteOnEvent* e = dynamic_cast<NoteOnEvent*>(event);
+        if (e->muted) return;
+        noteOn(e->getChannel(), e->getNote(), e->group, e->source);
+    }
+    else if (m_lyrics && event->type() == Event_Lyrics)
+    {
+        LyricsEvent* e = dynamic_cast<LyricsEvent*>(event);
+        console_text(e->c_str());
+    }
+    else if (m_lyrics && event->type() == Event_Text)
+    {
+        TextEvent* e = dynamic_cast<TextEvent*>(event);
+        console_line(e->c_str());
+    }
+}
+
+
+/* Returns the slot of m_playing a channel/note combination starts
+ * looking at
+ */
+int Player::slot(int mask) const
+{
+    return (mask * 2654435761u) & (m_playing.size() - 1);
+}
+
+
+/* Returns the drive that plays a channel/note combination, -1 if none
+ * does
+ */
+int Player::find(int mask) const
+{
+    int last = m_playing.size() - 1;
+    for (int s = slot(mask); m_playing[s] != -1; s = (s + 1) & last)
+    {
+        if (m_notes[m_playing[s]] == mask) return m_playing[s];
+    }
+    return -1;
+}
+
+
+/* Take a drive out of m_playing. The drives after it move up into the
+ * gap unless that's before the slot they start at, so find() never
+ * stops early.
+ */
+void Player::release(int drive)
+{
+    int last = m_playing.size() - 1;
+    int gap = slot(m_notes[drive]);
+    while (m_playing[gap] != drive) gap = (gap + 1) & last;
+    m_playing[gap] = -1;
+    for (int s = (gap + 1) & last; m_playing[s] != -1; s = (s + 1) & last)
+    {
+        int home = slot(m_notes[m_playing[s]]);
+        // Stays if home lies cyclically in (gap, s]
+        if (((s - home) & last) < ((s - gap) & last)) continue;
+        m_playing[gap] = m_playing[s];
+        m_playing[s] = -1;
+        gap = s;
+    }
+    m_notes[drive] = -1;
+}
+
+
+/* Start playing a note on a free drive of the given group (-1 for any
+ * drive). source is the track/channel combination the note came from,
+ * it is only used for the statistics. Returns the drive that plays the
+ * note or -1 if the note was dropped.
+ */
+int Player::noteOn(int channel, int note, int group, int source)
+{
+    // See if the drive is already reserved
+    int mask = MASK(channel, note);
+    int new_index = find(mask);
+    if (new_index == -1)
+    {
+        // See if a drive is free
+        for (int check = 0; check < m_dcount; ++check)
+        {
+            if (group != -1 && m_groups[check] != group)
+            {
+                // Drive belongs to another group
+                continue;
+            }
+            if (m_notes[check] == -1)
+            {
+                // Device is free
+                new_index = check;
+                break; // stop searching for a drive
+            }
+        }
+    }
+    if (new_index != -1)
+    {
+        if (m_notes[new_index] == -1)
+        {
+            m_notes[new_index] = mask;
+            int last = m_playing.size() - 1;
+            int s = slot(mask);
+            while (m_playing[s] != -1) s = (s + 1) & last;
+            m_playing[s] = new_index;
+        }
+        m_dmgr.play(new_index, m_frequencies[note & 0x7F]);
+        metrics_note(new_index, note);
+    }
+    else
+    {
+        if (source >= (int)m_dropped.size()) source = m_dropped.size() - 1;
+        ++m_dropped[source];
+        metrics_dropped();
+    }
+    return new_index;
+}
+
+
+/* Stop playing a note and release its drive back to the pool */
+void Player::noteOff(int channel, int note)
+{
+    int drive = find(MASK(channel, note));
+    if (drive == -1) return;
+    m_dmgr.stop(drive);
+    metrics_note(drive, -1);
+    release(drive);
+}
+
+
+/* The drive commands of the events that follow take effect at the given
+ * time, see DriveControl::schedule()
+ */
+void Player::schedule(long long at)
+{
+    m_dmgr.schedule(at);
+}
+
+
+/* Returns the frequency a note is played with */
+double Player::frequency(int note) const
+{
+    return m_frequencies[note & 0x7F];
+}
+
+
+/* Returns the number of notes that were dropped for lack of a free
+ * drive, per track/channel combination (see MidiFile::mergedTracks())
+ */
+std::map<int, int> Player::dropped() const
+{
+    std::map<int, int> result;
+    for (size_t source = 0; source < m_dropped.size(); ++source)
+    {
+        if (m_dropped[source]) result[source] = m_dropped[source];
+    }
+    return result;
+}
@@ -0,0 +1,59 @@
+#ifndef FM_PLAYER_HPP
+#define FM_PLAYER_HPP
+
+#include "DriveConfig.hpp"
+#include "DriveControl.hpp"
+#include "MidiEvent.hpp"
+#include <map>
+#include <vector>
+
+// Tracks with their own drop statistics, the notes of later tracks
+// are counted with the last one
+#define PLAYER_TRACKS 256
+
+/* The Player turns MIDI events into drive commands. It remembers which
+ * drive is playing which channel/note combination and hands out free
+ * drives on a first come, first served basis. Notes that are routed to
+ * a drive group only get drives of that group. It does not care about
+ * timing at all, that's up to whoever feeds it the events.
+ *
+ * Everything it needs is allocated by the constructor, handling an
+ * event never touches the heap.
+ */
+class Player
+{
+    private:
+    DriveControl &m_dmgr;
+    // Channel/note combination every drive plays, -1 if it's free
+    std::vector<int> m_notes;
+    // The playing drives by channel/note combination, an open addressing
+    // hash table at most half full, -1 for empty slots
+    std::vector<int> m_playing;
+    int m_dcount;
+    std::vector<int> m_groups;
+    double m_frequencies[128];
+    bool m_lyrics;
+    // Dropped notes by track/channel combination
+    std::vector<int> m_dropped;
+
+    Player(Player const &other);
+    Player& operator=(Player const &other);
+
+    int slot(int mask) const;
+    int find(int mask) const;
+    void release(int drive);
+
+    public:
+    Player(DriveControl &dmgr, DriveList const &drives, double drop_factor,
+            bool lyrics);
+
+    void handle(MidiEvent *event);
+    int noteOn(int channel, int note, int group, int source);
+    void noteOff(int channel, int note);
+    void schedule(long long at);
+
+    double frequency(int note) const;
+    std::map<int, int> dropped() const;
+};
+
+#endif
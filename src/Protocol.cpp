@@ -0,0 +1,58 @@
+#include "Protocol.hpp"
+#include <time.h>
+
+
+static void put64(unsigned char *buffer, long long value)
+{
+    for (int i = 7; i >= 0; --i)
+    {
+        buffer[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+
+static long long get64(unsigned char const *buffer)
+{
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        value = (value << 8) | buffer[i];
+    }
+    return value;
+}
+
+
+void encode_packet(Packet const &packet, unsigned char *buffer)
+{
+    buffer[0] = packet.type;
+    buffer[1] = packet.drive;
+    buffer[2] = buffer[3] = 0;
+    buffer[4] = packet.seq >> 24;
+    buffer[5] = packet.seq >> 16;
+    buffer[6] = packet.seq >> 8;
+    buffer[7] = packet.seq;
+    put64(buffer + 8, packet.a);
+    put64(buffer + 16, packet.b);
+    put64(buffer + 24, packet.c);
+}
+
+
+void decode_packet(unsigned char const *buffer, Packet &packet)
+{
+    packet.type = buffer[0];
+    packet.drive = buffer[1];
+    packet.seq = buffer[4] << 24 | buffer[5] << 16 | buffer[6] << 8
+        | buffer[7];
+    packet.a = get64(buffer + 8);
+    packet.b = get64(buffer + 16);
+    packet.c = get64(buffer + 24);
+}
+
+
+long long monotonic_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
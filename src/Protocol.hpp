@@ -0,0 +1,57 @@
+#ifndef FM_PROTOCOL_HPP
+#define FM_PROTOCOL_HPP
+
+/* The UDP protocol between a coordinator (Cluster) and its workers
+ * (Worker). Every packet is PACKET_SIZE bytes, all numbers are big
+ * endian:
+ *
+ *      byte  0     type
+ *      byte  1     drive
+ *      bytes 4-7   sequence number
+ *      bytes 8-15  a
+ *      bytes 16-23 b
+ *      bytes 24-31 c
+ *
+ * PACKET_SYNC          a = coordinator time of sending (t0)
+ * PACKET_SYNC_REPLY    a = t0, b = worker time of receiving (t1),
+ *                      c = worker time of replying (t2)
+ * PACKET_COMMAND       a = worker time the command is due,
+ *                      b = frequency in mHz, 0 to stop the drive
+ * PACKET_BYE           a = worker time the song is over, then every
+ *                      drive is stopped
+ * PACKET_STATE         like PACKET_COMMAND, but only applied if the
+ *                      drive doesn't play that already. The coordinator
+ *                      repeats the state of every drive now and then,
+ *                      so a lost command doesn't leave a drive droning.
+ *
+ * Times are CLOCK_MONOTONIC nanoseconds of the respective host.
+ */
+
+#define PACKET_SIZE 32
+// The drive is a single byte, a worker can't have more drives
+#define PACKET_MAX_DRIVES 256
+
+enum PacketType
+{
+    PACKET_SYNC = 1,
+    PACKET_SYNC_REPLY,
+    PACKET_COMMAND,
+    PACKET_BYE,
+    PACKET_STATE
+};
+
+struct Packet
+{
+    int type;
+    int drive;
+    unsigned int seq;
+    long long a;
+    long long b;
+    long long c;
+};
+
+void encode_packet(Packet const &packet, unsigned char *buffer);
+void decode_packet(unsigned char const *buffer, Packet &packet);
+long long monotonic_nsec();
+
+#endif
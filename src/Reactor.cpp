@@ -0,0 +1,80 @@
+#include "Reactor.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include <time.h>
+
+#define SEC_IN_NSEC (1000000000LL)
+#define TICK_NSEC (SEC_IN_NSEC / RESOLUTION)
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * SEC_IN_NSEC + t.tv_nsec;
+}
+
+
+static void sleep_until(long long deadline)
+{
+    timespec t;
+    t.tv_sec = deadline / SEC_IN_NSEC;
+    t.tv_nsec = deadline % SEC_IN_NSEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+        ; // interrupted by a signal, just go back to sleep
+}
+
+
+Reactor::Reactor(DriveManager &dmgr, Player &player) :
+    m_dmgr(dmgr), m_player(player)
+{}
+
+
+/* Play the given (merged) event list. Returns when the last event has
+ * been handled.
+ */
+void Reactor::run(EventList &events, SongClock &clock)
+{
+    long long start = now_nsec();
+    clock.start(start);
+    long long next_tick = start;
+    long long next_event, now, lateness;
+    bool busy;
+    EventList::iterator event = events.begin();
+    while (event != events.end())
+    {
+        next_event = clock.wallTime((*event)->absolute_nsec);
+        if (next_event <= next_tick)
+        {
+            // Events come first so that a note starting on this tick
+            // is already stepped by it
+            if (metrics)
+            {
+                metrics_event(now_nsec() - next_event);
+            }
+            TRACE_SCOPE("event");
+            m_player.handle(*event);
+            ++event;
+            continue;
+        }
+        sleep_until(next_tick);
+        now = now_nsec();
+        lateness = now - next_tick;
+        {
+            TRACE_SCOPE("tick");
+            busy = m_dmgr.tick();
+        }
+        next_tick += TICK_NSEC;
+        if (lateness > TICK_NSEC)
+        {
+            // We missed at least one tick, don't try to catch up
+            next_tick = now + TICK_NSEC;
+        }
+        if (!busy && next_event > next_tick)
+        {
+            // Nothing plays, sleep right through to the next event
+            next_tick = next_event;
+        }
+        metrics_tick(0, lateness, lateness > TICK_NSEC);
+    }
+}
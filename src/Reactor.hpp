@@ -0,0 +1,35 @@
+#ifndef FM_REACTOR_HPP
+#define FM_REACTOR_HPP
+
+#include "DriveManager.hpp"
+#include "MidiTrack.hpp"
+#include "Player.hpp"
+#include "SongClock.hpp"
+
+/* Single threaded playback engine. Instead of a play thread that sleeps
+ * between events and a drive thread that ticks on its own, the reactor
+ * keeps the deadline of the next MIDI event and the deadline of the
+ * next drive tick and always sleeps (with an absolute
+ * clock_nanosleep) until the earlier one. No locking, no context
+ * switches between the two, which is what you want on a single core
+ * Pi.
+ *
+ * The DriveManager has to be set up with setup(false). The events are
+ * due when the SongClock says so.
+ */
+class Reactor
+{
+    private:
+    DriveManager &m_dmgr;
+    Player &m_player;
+
+    Reactor(Reactor const &other);
+    Reactor& operator=(Reactor const &other);
+
+    public:
+    Reactor(DriveManager &dmgr, Player &player);
+
+    void run(EventList &events, SongClock &clock);
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include "Renderer.hpp"
+#include "DriveManager.hpp"
+#include "Output.hpp"
+#include "Player.hpp"
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 44100
+// Length of a single step click
+#define CLICK_SAMPLES (SAMPLE_RATE * 4 / 1000)
+// Audio is rendered and written in chunks of this many samples
+#define CHUNK_SAMPLES (SAMPLE_RATE * 10)
+#define SAMPLE_AT(tick) ((tick) * SAMPLE_RATE / RESOLUTION)
+
+
+/* Output that records the tick of every step. flush() is called once
+ * at the end of every tick, so it doubles as our clock.
+ */
+class StepRecorder : public Output
+{
+    private:
+    std::vector<std::vector<long long> > &m_steps;
+    long long m_tick;
+
+    public:
+    StepRecorder(std::vector<std::vector<long long> > &steps) :
+        m_steps(steps), m_tick(0)
+    {}
+
+    virtual void setup(Drive const &drive)
+    {}
+
+    virtual void direction(Drive const &drive, bool forward)
+    {}
+
+    virtual void step(Drive const &drive)
+    {
+        m_steps[drive.index].push_back(m_tick);
+    }
+
+    virtual void flush()
+    {
+        ++m_tick;
+    }
+};
+
+
+/* The sound of a single step: the head hitting its next position rings
+ * the drive's mechanics for a few milliseconds.
+ */
+static std::vector<float> make_click()
+{
+    std::vector<float> click(CLICK_SAMPLES);
+    for (int i = 0; i < CLICK_SAMPLES; ++i)
+    {
+        double t = (double)i / SAMPLE_RATE;
+        click[i] = std::exp(-t * 1500) * (0.6 * std::sin(2 * M_PI * 1800 * t)
+                + 0.4 * std::sin(2 * M_PI * 420 * t));
+    }
+    return click;
+}
+
+
+struct RenderJob
+{
+    std::vector<std::vector<long long> > const *steps;
+    std::vector<float> const *click;
+    // Drives first, first + stride, ... are rendered by this job
+    int first;
+    int stride;
+    // Current chunk
+    long long chunk_start;
+    std::vector<size_t> *cursors;
+    std::vector<std::vector<float> > *buffers;
+};
+
+
+/* Thread function: renders the clicks of the job's drives that fall
+ * into the current chunk
+ */
+static void *render_drives(void *arg)
+{
+    RenderJob *job = static_cast<RenderJob*>(arg);
+    std::vector<float> const &click = *job->click;
+    long long chunk_end = job->chunk_start + CHUNK_SAMPLES;
+    for (size_t d = job->first; d < job->steps->size(); d += job->stride)
+    {
+        std::vector<long long> const &steps = (*job->steps)[d];
+        std::vector<float> &buffer = (*job->buffers)[d];
+        size_t &cursor = (*job->cursors)[d];
+        std::fill(buffer.begin(), buffer.end(), 0.0f);
+        // Skip steps whose click ended before this chunk
+        while (cursor < steps.size()
+                && SAMPLE_AT(steps[cursor]) + CLICK_SAMPLES <= job->chunk_start)
+        {
+            ++cursor;
+        }
+        for (size_t s = cursor; s < steps.size(); ++s)
+        {
+            long long at = SAMPLE_AT(steps[s]);
+            if (at >= chunk_end) break;
+            for (int i = 0; i < CLICK_SAMPLES; ++i)
+            {
+                long long pos = at + i - job->chunk_start;
+                if (pos < 0) continue;
+                if (pos >= CHUNK_SAMPLES) break;
+                buffer[pos] += click[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static void write_le(std::ostream &out, unsigned int value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out.put((char)((value >> (8 * i)) & 0xFF));
+    }
+}
+
+
+static void write_wav_header(std::ostream &out, unsigned int frames)
+{
+    unsigned int data_size = frames * 2 * 2;
+    out.write("RIFF", 4);
+    write_le(out, 36 + data_size, 4);
+    out.write("WAVEfmt ", 8);
+    write_le(out, 16, 4);                   // fmt chunk size
+    write_le(out, 1, 2);                    // PCM
+    write_le(out, 2, 2);                    // stereo
+    write_le(out, SAMPLE_RATE, 4);
+    write_le(out, SAMPLE_RATE * 2 * 2, 4);  // bytes per second
+    write_le(out, 2 * 2, 2);                // bytes per frame
+    write_le(out, 16, 2);                   // bits per sample
+    out.write("data", 4);
+    write_le(out, data_size, 4);
+}
+
+
+Renderer::Renderer(DriveList const &drives, double drop_factor) :
+    m_drives(drives), m_drop_factor(drop_factor),
+    m_steps(drives.size()), m_ticks(0)
+{}
+
+
+/* Run the step engine on the virtual clock and record the steps */
+void Renderer::simulate(EventList const &events)
+{
+    StepRecorder recorder(m_steps);
+    DriveManager dmgr(m_drives, recorder);
+    Player player(dmgr, m_drives, m_drop_factor, false);
+    long long due;
+    for (EventList::const_iterator event = events.begin();
+            event != events.end(); ++event)
+    {
+        due = (*event)->absolute_nsec * RESOLUTION / 1000000000;
+        while (m_ticks < due)
+        {
+            dmgr.tick();
+            ++m_ticks;
+        }
+        player.handle(*event);
+    }
+}
+
+
+/* Render the given (merged and transformed) event list into the WAV
+ * file at path. Returns false if the file can't be written.
+ */
+bool Renderer::render(EventList const &events, std::string const &path)
+{
+    std::ofstream out(path.c_str(), std::ios::binary);
+    if (!out.good())
+    {
+        std::cerr << "Can't open " << path << ": " << std::strerror(errno)
+            << std::endl;
+        return false;
+    }
+
+    simulate(events);
+    int dcount = m_drives.size();
+    long long frames = SAMPLE_AT(m_ticks) + CLICK_SAMPLES;
+
+    // Constant power panning, drives without a position are spread
+    // evenly from left to right
+    std::vector<float> left(dcount), right(dcount);
+    for (int d = 0; d < dcount; ++d)
+    {
+        double pan = m_drives[d].pan;
+        if (pan == PAN_AUTO)
+        {
+            pan = dcount > 1 ? -1 + 2.0 * d / (dcount - 1) : 0;
+        }
+        double angle = (pan + 1) * M_PI / 4;
+        // Keep some headroom for many drives clicking at once
+        left[d] = std::cos(angle) / std::sqrt((double)dcount);
+        right[d] = std::sin(angle) / std::sqrt((double)dcount);
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = dcount < cores ? dcount : (cores > 0 ? cores : 1);
+    std::vector<float> click = make_click();
+    std::vector<size_t> cursors(dcount, 0);
+    std::vector<std::vector<float> > buffers(dcount,
+            std::vector<float>(CHUNK_SAMPLES));
+    std::vector<RenderJob> jobs(workers);
+    std::vector<pthread_t> threads(workers);
+    std::vector<char> pcm(CHUNK_SAMPLES * 4);
+
+    write_wav_header(out, frames);
+    for (long long chunk = 0; chunk < frames; chunk += CHUNK_SAMPLES)
+    {
+        for (int w = 0; w < workers; ++w)
+        {
+            RenderJob job = {&m_steps, &click, w, workers, chunk,
+                &cursors, &buffers};
+            jobs[w] = job;
+            pthread_create(&threads[w], NULL, render_drives, &jobs[w]);
+        }
+        for (int w = 0; w < workers; ++w)
+        {
+            pthread_join(threads[w], NULL);
+        }
+
+        long long length = frames - chunk;
+        if (length > CHUNK_SAMPLES) length = CHUNK_SAMPLES;
+        for (long long i = 0; i < length; ++i)
+        {
+            float l = 0, r = 0;
+            for (int d = 0; d < dcount; ++d)
+            {
+                l += buffers[d][i] * left[d];
+                r += buffers[d][i] * right[d];
+            }
+            int sl = l * 30000, sr = r * 30000;
+            sl = sl > 32767 ? 32767 : (sl < -32768 ? -32768 : sl);
+            sr = sr > 32767 ? 32767 : (sr < -32768 ? -32768 : sr);
+            pcm[4*i] = sl & 0xFF;
+            pcm[4*i+1] = (sl >> 8) & 0xFF;
+            pcm[4*i+2] = sr & 0xFF;
+            pcm[4*i+3] = (sr >> 8) & 0xFF;
+        }
+        out.write(&pcm[0], length * 4);
+    }
+
+    if (!out.good())
+    {
+        std::cerr << "Error writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
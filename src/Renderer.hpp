@@ -0,0 +1,32 @@
+#ifndef FM_RENDERER_HPP
+#define FM_RENDERER_HPP
+
+#include "DriveConfig.hpp"
+#include "MidiTrack.hpp"
+#include <string>
+#include <vector>
+
+/* Renders what the drives would sound like into a WAV file. The step
+ * engine runs on a virtual clock first and records when every drive
+ * steps, then each drive is synthesized (a short click per step, at
+ * audio rates the clicks become the typical buzz) in parallel and the
+ * drives are mixed down to stereo.
+ */
+class Renderer
+{
+    private:
+    DriveList m_drives;
+    double m_drop_factor;
+    // Step times of every drive, in ticks
+    std::vector<std::vector<long long> > m_steps;
+    long long m_ticks;
+
+    void simulate(EventList const &events);
+
+    public:
+    Renderer(DriveList const &drives, double drop_factor);
+
+    bool render(EventList const &events, std::string const &path);
+};
+
+#endif
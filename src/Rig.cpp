@@ -0,0 +1,231 @@
+#include "Rig.hpp"
+#include "AllocCheck.hpp"
+#include "GpioChipOutput.hpp"
+#include "Player.hpp"
+#include "SpiOutput.hpp"
+#include "Stream.hpp"
+#include "Trace.hpp"
+#include "gpio.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <time.h>
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+Rig::Rig() :
+    m_shard_count(1), m_output(0), m_engine(0), m_reactor(0), m_gpio(0),
+    m_fixed(false), m_heads(0), m_lookahead(DEFAULT_LOOKAHEAD),
+    m_stopping(false)
+{}
+
+
+Rig::~Rig()
+{
+    // Stop the drive threads before their output goes away
+    delete m_engine;
+    delete m_reactor;
+    delete m_gpio;
+    delete m_output;
+    delete m_heads;
+}
+
+
+/* Read the drive configuration at path and split the drives into the
+ * given number of shards (see DriveShards::assign()). Returns false if
+ * the configuration is invalid.
+ */
+bool Rig::read(std::string const &path, int shards)
+{
+    std::ifstream inp(path.c_str());
+    if (!inp.good())
+    {
+        std::cerr << "Can't open " << path << ": " << std::strerror(errno)
+            << std::endl;
+        return false;
+    }
+    m_config = DriveConfig(inp);
+    if (!m_config.isValid())
+    {
+        std::cerr << "Invalid drive configuration " << path << std::endl;
+        return false;
+    }
+    m_drives = m_config.getDrives();
+    m_shard_count = DriveShards::assign(m_drives, shards);
+    if (m_shard_count > 1 && (m_config.usesSpi() || !m_config.getChip().empty()))
+    {
+        std::cerr << "All drives share the shift registers or the line "
+            "request of the GPIO chip, they can't be split into shards"
+            << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/* Set up what the drives are connected to: the GPIO registers, the
+ * lines of a GPIO character device if the configuration has a gpiochip
+ * line or the shift registers if it has an spi line. Returns false on
+ * error.
+ */
+bool Rig::open()
+{
+    TRACE_SCOPE("setup output");
+    if (!m_config.getChip().empty())
+    {
+        GpioChipOutput *chip = new GpioChipOutput(m_config.getChip());
+        m_output = chip;
+        return chip->open(m_drives);
+    }
+    if (m_config.usesSpi())
+    {
+        SpiOutput *spi = new SpiOutput(m_config.getSpi());
+        m_output = spi;
+        return spi->open();
+    }
+    return setup_io();
+}
+
+
+/* Keep the head positions in the file at path between runs (see
+ * HeadState). Call before start().
+ */
+void Rig::setHeadState(std::string const &path)
+{
+    if (m_heads) return;
+    m_heads = new HeadState(path);
+    if (m_heads->load())
+    {
+        std::cout << "Using the head positions from " << path << std::endl;
+    }
+}
+
+
+/* How long (ns) play() hands the notes to the drive threads before they
+ * are due, which then start them on the exact tick. It has to cover how
+ * late the playing thread wakes up, 0 plays the notes when it does.
+ */
+void Rig::setLookahead(long long lookahead)
+{
+    m_lookahead = lookahead;
+}
+
+
+/* Reseed the drives and start the drive threads. Call after open(). */
+void Rig::start()
+{
+    engine().setHeadState(m_heads);
+    engine().setup();
+}
+
+
+/* Play the song, with the events scheduled by clock (which is started
+ * now) and late events handled by catch_up. Returns when the song is
+ * over, or false after stop() was called. Every drive is stopped at
+ * the end.
+ */
+bool Rig::play(Song &song, SongClock &clock, CatchUp &catch_up,
+        double drop_factor, bool lyrics)
+{
+    Player player(engine(), m_drives, drop_factor, lyrics);
+    __atomic_store_n(&m_stopping, false, __ATOMIC_RELAXED);
+    clock.start(now_nsec());
+    ALLOC_CHECK_BEGIN();
+    bool finished = play_events(song.events(), player, clock, catch_up,
+            &m_stopping, m_lookahead);
+    ALLOC_CHECK_END();
+    // The stops don't wait, but they still come after the notes that
+    // are scheduled already
+    engine().schedule(0);
+    for (size_t d = 0; d < m_drives.size(); ++d)
+    {
+        engine().stop(d);
+    }
+    return finished;
+}
+
+
+/* Make play() return at the next event */
+void Rig::stop()
+{
+    __atomic_store_n(&m_stopping, true, __ATOMIC_RELAXED);
+}
+
+
+DriveConfig const &Rig::config() const
+{
+    return m_config;
+}
+
+
+/* The drives of the configuration, with their shards */
+DriveList const &Rig::drives() const
+{
+    return m_drives;
+}
+
+
+int Rig::shardCount() const
+{
+    return m_shard_count;
+}
+
+
+/* The output all drives share, or 0 if every shard writes the GPIO
+ * registers on its own
+ */
+Output *Rig::output() const
+{
+    return m_output;
+}
+
+
+HeadState *Rig::headState() const
+{
+    return m_heads;
+}
+
+
+/* The drive engine, created on first use. Tries the engine compiled for
+ * the rig (make FIXED_RIG=...) first, see fixedEngine().
+ */
+DriveShards &Rig::engine()
+{
+    if (m_engine) return *m_engine;
+    m_engine = new DriveShards(m_drives, m_shard_count, m_output);
+    // It bypasses the output, the drives have to be on the GPIO registers
+    m_fixed = !m_output && m_engine->useFixedRig();
+    return *m_engine;
+}
+
+
+/* A single DriveManager for all drives that doesn't tick on its own
+ * but when its tick() is called (--reactor), to use instead of
+ * engine(). Created on first use like engine(), with the head state.
+ * It still has to be setup(false).
+ */
+DriveManager &Rig::reactor()
+{
+    if (m_reactor) return *m_reactor;
+    if (!m_output) m_gpio = new GpioOutput();
+    m_reactor = new DriveManager(m_drives,
+            m_output ? *m_output : *m_gpio);
+    m_fixed = !m_output && m_reactor->useFixedRig();
+    m_reactor->setHeadState(m_heads);
+    return *m_reactor;
+}
+
+
+/* Whether the engine (or reactor) is the one compiled for the rig */
+bool Rig::fixedEngine() const
+{
+    return m_fixed;
+}
@@ -0,0 +1,80 @@
+#ifndef FM_RIG_HPP
+#define FM_RIG_HPP
+
+#include "CatchUp.hpp"
+#include "DriveConfig.hpp"
+#include "DriveManager.hpp"
+#include "DriveShards.hpp"
+#include "GpioOutput.hpp"
+#include "HeadState.hpp"
+#include "Output.hpp"
+#include "SongClock.hpp"
+#include "Song.hpp"
+#include <string>
+
+// How far ahead of the drive thread the songs are played, in ns
+#define DEFAULT_LOOKAHEAD 2000000
+
+/* The drives of a drive configuration, what they are connected to and
+ * the drive engine that steps them. This is what a program that plays
+ * songs on its own drives needs (see floppymusic.h for the C version):
+ *
+ *     Rig rig;
+ *     if (!rig.read("drives.cfg") || !rig.open()) ...
+ *     rig.start();
+ *     Song song;
+ *     if (!song.read("song.mid")) ...
+ *     song.apply(Transform(rig.drives(), rig.config().getGroups().size()));
+ *     SongClock clock(NORMAL_SPEED);
+ *     CatchUp catch_up(CATCH_UP_NONE, song.events());
+ *     rig.play(song, clock, catch_up);
+ *
+ * Errors are printed to stderr. Only stop() may be called from another
+ * thread (and the clock's setSpeed(), to change the tempo).
+ */
+class Rig
+{
+    private:
+    DriveConfig m_config;
+    DriveList m_drives;
+    int m_shard_count;
+    // The output all drives share, 0 for the GPIO registers
+    Output *m_output;
+    DriveShards *m_engine;
+    // Instead of m_engine with --reactor, and its output if there is
+    // no shared one
+    DriveManager *m_reactor;
+    GpioOutput *m_gpio;
+    // The engine compiled for the rig (make FIXED_RIG=...) is used
+    bool m_fixed;
+    HeadState *m_heads;
+    long long m_lookahead;
+    bool m_stopping;
+
+    Rig(Rig const &other);
+    Rig& operator=(Rig const &other);
+
+    public:
+    Rig();
+    ~Rig();
+
+    bool read(std::string const &path, int shards = 1);
+    bool open();
+    void setHeadState(std::string const &path);
+    void setLookahead(long long lookahead);
+    void start();
+    bool play(Song &song, SongClock &clock, CatchUp &catch_up,
+            double drop_factor = 1, bool lyrics = false);
+    void stop();
+
+    DriveConfig const &config() const;
+    DriveList const &drives() const;
+    int shardCount() const;
+    Output *output() const;
+    HeadState *headState() const;
+    DriveShards &engine();
+    DriveManager &reactor();
+    bool fixedEngine() const;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "Song.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+Song::Song()
+{}
+
+
+/* Read the MIDI file at path and merge its tracks, with the given
+ * track/channel combinations muted. Returns false on error.
+ */
+bool Song::read(std::string const &path, std::set<int> const &muted)
+{
+    std::ifstream input(path.c_str());
+    if (!input.good())
+    {
+        std::cerr << "Error reading '" << path << "': "
+            << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (!m_midi.read(input))
+    {
+        std::cerr << "Invalid MIDI file '" << path << "'" << std::endl;
+        return false;
+    }
+    if (m_midi.getFormatType() == 2)
+    {
+        std::cerr << path << " is a MIDI file of type 2 and not supported "
+            "(yet) by floppymusic :(" << std::endl;
+        return false;
+    }
+    m_events = m_midi.mergedTracks(muted);
+    return true;
+}
+
+
+/* Run the song through the transform stage */
+void Song::apply(Transform const &transform)
+{
+    m_events = transform.apply(m_events);
+}
+
+
+EventList &Song::events()
+{
+    return m_events;
+}
+
+
+int Song::trackCount() const
+{
+    return m_midi.getTrackCount();
+}
+
+
+/* The time of the last event in ns */
+long long Song::duration() const
+{
+    return m_events.empty() ? 0 : m_events.back()->absolute_nsec;
+}
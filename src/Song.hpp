@@ -0,0 +1,35 @@
+#ifndef FM_SONG_HPP
+#define FM_SONG_HPP
+
+#include "MidiFile.hpp"
+#include "Transform.hpp"
+#include <set>
+#include <string>
+
+/* A song from a MIDI file, with its tracks merged into a single one
+ * (see MidiFile::mergedTracks()) and, after apply(), run through the
+ * transform stage. That's what Rig::play(), a Stream and the Analyzer
+ * play.
+ */
+class Song
+{
+    private:
+    MidiFile m_midi;
+    EventList m_events;
+
+    Song(Song const &other);
+    Song& operator=(Song const &other);
+
+    public:
+    Song();
+
+    bool read(std::string const &path,
+            std::set<int> const &muted = std::set<int>());
+    void apply(Transform const &transform);
+
+    EventList &events();
+    int trackCount() const;
+    long long duration() const;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "SongClock.hpp"
+
+
+SongClock::SongClock(int speed) :
+    m_wall(0), m_song(0), m_speed(speed)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+
+SongClock::~SongClock()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+
+/* The song starts at now (CLOCK_MONOTONIC ns) */
+void SongClock::start(long long now)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_wall = now;
+    m_song = 0;
+    pthread_mutex_unlock(&m_mutex);
+}
+
+
+/* Returns when the given time into the song is due */
+long long SongClock::wallTime(long long song)
+{
+    pthread_mutex_lock(&m_mutex);
+    long long wall = m_wall + (song - m_song) * NORMAL_SPEED / m_speed;
+    pthread_mutex_unlock(&m_mutex);
+    return wall;
+}
+
+
+/* Play at the given speed from now on. The song time reached at now
+ * becomes the new anchor.
+ */
+void SongClock::setSpeed(int speed, long long now)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_song += (now - m_wall) * m_speed / NORMAL_SPEED;
+    m_wall = now;
+    m_speed = speed;
+    pthread_mutex_unlock(&m_mutex);
+}
+
+
+int SongClock::speed()
+{
+    pthread_mutex_lock(&m_mutex);
+    int speed = m_speed;
+    pthread_mutex_unlock(&m_mutex);
+    return speed;
+}
@@ -0,0 +1,41 @@
+#ifndef FM_SONG_CLOCK_HPP
+#define FM_SONG_CLOCK_HPP
+
+#include <pthread.h>
+
+#define NORMAL_SPEED 1000
+
+/* Maps the time into the song (the absolute_nsec of the events, which
+ * the tempo map derives from the MIDI ticks) to CLOCK_MONOTONIC time,
+ * with a speed that can be changed during playback. The speed is in
+ * per mille of the song's own tempo.
+ *
+ * The clock is anchored at the time of the last speed change and the
+ * song time at that moment, so a change takes effect with the next
+ * event that is scheduled and costs O(1): nothing is recalculated, and
+ * since every deadline is computed from the anchor the song doesn't
+ * drift however often the speed changes.
+ */
+class SongClock
+{
+    private:
+    pthread_mutex_t m_mutex;
+    // CLOCK_MONOTONIC and song time of the anchor, both in ns
+    long long m_wall;
+    long long m_song;
+    int m_speed;
+
+    SongClock(SongClock const &other);
+    SongClock& operator=(SongClock const &other);
+
+    public:
+    SongClock(int speed);
+    ~SongClock();
+
+    void start(long long now);
+    long long wallTime(long long song);
+    void setSpeed(int speed, long long now);
+    int speed();
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "SpiOutput.hpp"
+#include "DriveManager.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// Frames besides the pulse groups: directions and step bits high
+#define FIXED_FRAMES 2
+
+
+SpiOutput::SpiOutput(SpiConfig const &config) :
+    m_config(config), m_fd(-1), m_mock(false),
+    m_state(config.registers, 0), m_steps(config.registers, 0),
+    m_direction_changed(false), m_stepping(false),
+    m_frames(FIXED_FRAMES * config.registers),
+    m_transfers(FIXED_FRAMES),
+    m_transfer_nsec(config.registers * 8 * 1000000000LL / config.speed)
+{}
+
+
+SpiOutput::~SpiOutput()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+
+/* Open the device and clear all outputs. Returns false on error. */
+bool SpiOutput::open()
+{
+    m_fd = ::open(m_config.device.c_str(), O_WRONLY);
+    if (m_fd < 0)
+    {
+        std::cerr << "Can't open " << m_config.device << ": "
+            << std::strerror(errno) << std::endl;
+        return false;
+    }
+    unsigned char mode = SPI_MODE_0;
+    unsigned int speed = m_config.speed;
+    if (ioctl(m_fd, SPI_IOC_WR_MODE, &mode) < 0
+            || ioctl(m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)
+    {
+        if (errno != ENOTTY)
+        {
+            std::cerr << "Can't set up " << m_config.device << ": "
+                << std::strerror(errno) << std::endl;
+            return false;
+        }
+        std::cout << m_config.device << " is no SPI device, writing the "
+            "frames into it" << std::endl;
+        m_mock = true;
+    }
+    addFrame(0, &m_state[0], 0);
+    send(1);
+    return true;
+}
+
+
+void SpiOutput::setup(Drive const &drive)
+{
+    std::vector<PulseGroup>::iterator group = m_pulses.begin();
+    while (group != m_pulses.end() && group->width < drive.pulse)
+    {
+        ++group;
+    }
+    if (group == m_pulses.end() || group->width != drive.pulse)
+    {
+        PulseGroup g;
+        g.width = drive.pulse;
+        g.bits.resize(m_config.registers, 0);
+        group = m_pulses.insert(group, g);
+        // Room for one more frame per tick
+        m_frames.resize(m_frames.size() + m_config.registers);
+        m_transfers.resize(m_transfers.size() + 1);
+    }
+    group->bits[drive.stepper_pin / 8] |= 1 << (drive.stepper_pin % 8);
+}
+
+
+void SpiOutput::direction(Drive const &drive, bool forward)
+{
+    unsigned char bit = 1 << (drive.direction_pin % 8);
+    if (forward)
+    {
+        m_state[drive.direction_pin / 8] |= bit;
+    }
+    else
+    {
+        m_state[drive.direction_pin / 8] &= ~bit;
+    }
+    m_direction_changed = true;
+}
+
+
+void SpiOutput::step(Drive const &drive)
+{
+    m_steps[drive.stepper_pin / 8] |= 1 << (drive.stepper_pin % 8);
+    m_stepping = true;
+}
+
+
+/* Put the given outputs (by register) into frame number frame, which
+ * is latched delay_usecs after it has been shifted out
+ */
+void SpiOutput::addFrame(int frame, unsigned char const *bits,
+        int delay_usecs)
+{
+    int registers = m_config.registers;
+    unsigned char *out = &m_frames[frame * registers];
+    // The first byte ends up in the last register of the chain
+    for (int r = 0; r < registers; ++r)
+    {
+        out[r] = bits[registers - 1 - r];
+    }
+    spi_ioc_transfer &transfer = m_transfers[frame];
+    std::memset(&transfer, 0, sizeof(transfer));
+    transfer.tx_buf = (unsigned long)out;
+    transfer.len = registers;
+    transfer.speed_hz = m_config.speed;
+    transfer.bits_per_word = 8;
+    transfer.delay_usecs = delay_usecs;
+    // Deselect after every frame to latch it
+    transfer.cs_change = 1;
+}
+
+
+/* Send the first frames frames with a single ioctl (or write) */
+void SpiOutput::send(int frames)
+{
+    if (m_mock)
+    {
+        ssize_t ignored = write(m_fd, &m_frames[0],
+                frames * m_config.registers);
+        (void)ignored;
+        return;
+    }
+    // On the last transfer cs_change would keep the chip selected
+    m_transfers[frames - 1].cs_change = 0;
+    ioctl(m_fd, SPI_IOC_MESSAGE(frames), &m_transfers[0]);
+}
+
+
+void SpiOutput::flush()
+{
+    if (!m_stepping && !m_direction_changed) return;
+    int registers = m_config.registers;
+    int frames = 0;
+    if (m_direction_changed)
+    {
+        // Directions first, so they are stable when the step comes
+        addFrame(frames++, &m_state[0], 0);
+        m_direction_changed = false;
+    }
+    if (m_stepping)
+    {
+        for (int r = 0; r < registers; ++r)
+        {
+            m_state[r] |= m_steps[r];
+        }
+        addFrame(frames++, &m_state[0], 0);
+        // The steps have been high for elapsed ns when the next frame
+        // is latched
+        long long elapsed = 0;
+        for (std::vector<PulseGroup>::const_iterator group = m_pulses.begin();
+                group != m_pulses.end(); ++group)
+        {
+            bool clears = false;
+            for (int r = 0; r < registers; ++r)
+            {
+                unsigned char bits = m_steps[r] & group->bits[r];
+                if (bits)
+                {
+                    m_state[r] &= ~bits;
+                    clears = true;
+                }
+            }
+            if (!clears) continue;
+            long long wait = group->width - elapsed - m_transfer_nsec;
+            int delay = wait > 0 ? (wait + 999) / 1000 : 0;
+            elapsed += m_transfer_nsec + delay * 1000LL;
+            addFrame(frames++, &m_state[0], delay);
+        }
+        std::memset(&m_steps[0], 0, registers);
+        m_stepping = false;
+    }
+    send(frames);
+}
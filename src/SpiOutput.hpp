@@ -0,0 +1,67 @@
+#ifndef FM_SPI_OUTPUT_HPP
+#define FM_SPI_OUTPUT_HPP
+
+#include "DriveConfig.hpp"
+#include "Output.hpp"
+#include <linux/spi/spidev.h>
+#include <vector>
+
+/* Output to a chain of 74HC595 shift registers on a spidev device, for
+ * more drives than the Pi has pins. The latch clock (RCLK) of all
+ * registers is connected to the chip select, so a frame that is shifted
+ * out shows up on all outputs at once when the chip select goes high
+ * again.
+ *
+ * Every tick with steps sends the frames of the tick with a single
+ * ioctl: the new directions (if they changed), all step bits high and
+ * then the step bits low again, grouped by pulse width like GpioOutput
+ * does. The pulse widths are rounded up to whole microseconds.
+ *
+ * If the device is not a spidev device, like a plain file or a named
+ * pipe, the frames are written to it instead (registers bytes per
+ * frame, the register furthest down the chain first), to test a
+ * configuration without the hardware.
+ */
+class SpiOutput : public Output
+{
+    private:
+    struct PulseGroup
+    {
+        int width;
+        std::vector<unsigned char> bits;
+    };
+
+    SpiConfig m_config;
+    int m_fd;
+    bool m_mock;
+    // Current outputs and the step bits of this tick, by register
+    std::vector<unsigned char> m_state;
+    std::vector<unsigned char> m_steps;
+    bool m_direction_changed;
+    bool m_stepping;
+    // Sorted by width
+    std::vector<PulseGroup> m_pulses;
+    // Preallocated for the frames and transfers of a tick
+    std::vector<unsigned char> m_frames;
+    std::vector<spi_ioc_transfer> m_transfers;
+    int m_transfer_nsec;
+
+    SpiOutput(SpiOutput const &other);
+    SpiOutput& operator=(SpiOutput const &other);
+
+    void addFrame(int frame, unsigned char const *bits, int delay_usecs);
+    void send(int frames);
+
+    public:
+    SpiOutput(SpiConfig const &config);
+    ~SpiOutput();
+
+    bool open();
+
+    virtual void setup(Drive const &drive);
+    virtual void direction(Drive const &drive, bool forward);
+    virtual void step(Drive const &drive);
+    virtual void flush();
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "Stream.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include <iostream>
+#include <time.h>
+
+#define SEC_IN_NSEC (1000000000LL)
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * SEC_IN_NSEC + t.tv_nsec;
+}
+
+
+static void sleep_until(long long deadline)
+{
+    timespec t;
+    t.tv_sec = deadline / SEC_IN_NSEC;
+    t.tv_nsec = deadline % SEC_IN_NSEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+        ; // interrupted by a signal, just go back to sleep
+}
+
+
+/* Play the events with the drive threads doing the stepping, sleeping
+ * until every event is due. The clock has to be started. If stopping
+ * is given the events stop once it is set, which makes it return false.
+ *
+ * With a lookahead (ns) it wakes up that much before an event and
+ * schedules its commands for the deadline, so the drive thread starts
+ * the notes on time even if this thread woke up late (but less than
+ * the lookahead). The drives have to be scheduled again by the caller.
+ */
+bool play_events(EventList &track, Player &player, SongClock &clock,
+        CatchUp &catch_up, bool const *stopping, long long lookahead)
+{
+    long long deadline = 0;
+    long long now;
+    for (size_t i = 0; i < track.size(); ++i)
+    {
+        MidiEvent *event = track[i];
+        // Sleep until the event is due. The deadlines are absolute, so
+        // the time spent on the events doesn't add up.
+        if (event->relative_nsec || i == 0)
+        {
+            deadline = catch_up.deadline(clock.wallTime(event->absolute_nsec));
+            sleep_until(deadline - lookahead);
+            if (lookahead) player.schedule(deadline);
+        }
+        if (stopping && __atomic_load_n(stopping, __ATOMIC_RELAXED))
+        {
+            return false;
+        }
+        now = now_nsec();
+        if (metrics)
+        {
+            metrics_event(now - deadline + lookahead);
+        }
+        TRACE_SCOPE("event");
+        if (catch_up.skip(i, deadline, now, clock)) continue;
+        player.handle(event);
+        catch_up.played(deadline, now);
+    }
+    return true;
+}
+
+
+SharedControl::SharedControl(DriveControl &control) :
+    m_control(control)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+
+SharedControl::~SharedControl()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+
+void SharedControl::play(int drive, double frequency)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_control.play(drive, frequency);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+
+void SharedControl::stop(int drive)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_control.stop(drive);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+
+Stream::Stream(std::string const &group_name, int group,
+        std::string const &path, DriveControl &control,
+        DriveList const &drives, double drop_factor, int tempo) :
+    m_group_name(group_name), m_path(path), m_group(group),
+    m_player(control, drives, drop_factor, false), m_clock(tempo),
+    m_catch_up(0), m_running(false)
+{}
+
+
+Stream::~Stream()
+{
+    join();
+    delete m_catch_up;
+}
+
+
+/* Read the song and run it through the transform, with every note
+ * going to the group of the stream. Returns false on error.
+ */
+bool Stream::load(Transform &transform, CatchUpPolicy policy)
+{
+    if (!m_song.read(m_path))
+    {
+        return false;
+    }
+    transform.setGroup(m_group);
+    m_song.apply(transform);
+    m_catch_up = new CatchUp(policy, m_song.events());
+    return true;
+}
+
+
+static void *_stream_jumper(void *stream)
+{
+    reinterpret_cast<Stream*>(stream)->run();
+    return NULL;
+}
+
+
+/* Start the play thread, the song starts at start (CLOCK_MONOTONIC ns) */
+void Stream::start(long long start)
+{
+    m_clock.start(start);
+    m_running = true;
+    pthread_create(&m_thread, NULL, _stream_jumper, this);
+}
+
+
+/* Wait until the song is over */
+void Stream::join()
+{
+    if (!m_running) return;
+    pthread_join(m_thread, NULL);
+    m_running = false;
+}
+
+
+void Stream::run()
+{
+    TRACE_THREAD("stream");
+    play_events(m_song.events(), m_player, m_clock, *m_catch_up);
+}
+
+
+void Stream::report(std::ostream &out) const
+{
+    out << m_group_name << " (" << m_path << "):" << std::endl;
+    m_catch_up->report(out);
+}
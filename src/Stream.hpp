@@ -0,0 +1,77 @@
+#ifndef FM_STREAM_HPP
+#define FM_STREAM_HPP
+
+#include "CatchUp.hpp"
+#include "DriveConfig.hpp"
+#include "DriveControl.hpp"
+#include "Player.hpp"
+#include "Song.hpp"
+#include "SongClock.hpp"
+#include "Transform.hpp"
+#include <ostream>
+#include <pthread.h>
+#include <string>
+
+bool play_events(EventList &track, Player &player, SongClock &clock,
+        CatchUp &catch_up, bool const *stopping = 0, long long lookahead = 0);
+
+
+/* Lets the play threads of several streams share a DriveControl. The
+ * command queue of a DriveManager takes one writer only, so they take
+ * turns.
+ */
+class SharedControl : public DriveControl
+{
+    private:
+    DriveControl &m_control;
+    pthread_mutex_t m_mutex;
+
+    SharedControl(SharedControl const &other);
+    SharedControl& operator=(SharedControl const &other);
+
+    public:
+    SharedControl(DriveControl &control);
+    ~SharedControl();
+
+    virtual void play(int drive, double frequency);
+    virtual void stop(int drive);
+};
+
+
+/* A song that plays on the drives of a group while other streams play
+ * their songs on the other groups (--stream GROUP=FILE). Every stream
+ * has a play thread, a clock, a catch-up policy and a Player of its
+ * own. The Player only hands out the drives of the group, so the
+ * streams can't take drives from each other, but they all share the
+ * drive engine.
+ */
+class Stream
+{
+    private:
+    std::string m_group_name;
+    std::string m_path;
+    int m_group;
+    Song m_song;
+    Player m_player;
+    SongClock m_clock;
+    CatchUp *m_catch_up;
+    pthread_t m_thread;
+    bool m_running;
+
+    Stream(Stream const &other);
+    Stream& operator=(Stream const &other);
+
+    public:
+    Stream(std::string const &group_name, int group, std::string const &path,
+            DriveControl &control, DriveList const &drives,
+            double drop_factor, int tempo);
+    ~Stream();
+
+    bool load(Transform &transform, CatchUpPolicy policy);
+    void start(long long start);
+    void join();
+    void run();
+    void report(std::ostream &out) const;
+};
+
+#endif
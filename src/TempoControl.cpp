@@ -0,0 +1,117 @@
+#include "TempoControl.hpp"
+#include <csignal>
+#include <cstdio>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// How often the thread checks whether it should stop, in ms
+#define POLL_INTERVAL 100
+
+static termios saved_termios;
+static bool terminal_changed = false;
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+static void restore_terminal()
+{
+    if (!terminal_changed) return;
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+    terminal_changed = false;
+}
+
+
+/* Don't leave the terminal without echo when we are interrupted */
+static void on_signal(int sig)
+{
+    restore_terminal();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+
+TempoControl::TempoControl(SongClock &clock) :
+    m_clock(clock), m_running(false)
+{}
+
+
+TempoControl::~TempoControl()
+{
+    stop();
+}
+
+
+static void *_tempo_jumper(void *control)
+{
+    reinterpret_cast<TempoControl*>(control)->loop();
+    return NULL;
+}
+
+
+void TempoControl::start()
+{
+    if (m_running) return;
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_termios) == 0)
+    {
+        termios raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        terminal_changed = true;
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+    }
+    m_running = true;
+    pthread_create(&m_thread, NULL, _tempo_jumper, this);
+}
+
+
+void TempoControl::stop()
+{
+    if (!m_running) return;
+    __atomic_store_n(&m_running, false, __ATOMIC_RELAXED);
+    pthread_join(m_thread, NULL);
+    restore_terminal();
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+}
+
+
+void TempoControl::loop()
+{
+    pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    char key;
+    while (__atomic_load_n(&m_running, __ATOMIC_RELAXED))
+    {
+        if (poll(&pfd, 1, POLL_INTERVAL) <= 0) continue;
+        if (read(STDIN_FILENO, &key, 1) != 1)
+        {
+            // End of input, nothing more to control
+            return;
+        }
+        int speed = m_clock.speed();
+        switch (key)
+        {
+            case '+': speed += 10; break;
+            case '-': speed -= 10; break;
+            case '>': speed += 1; break;
+            case '<': speed -= 1; break;
+            case '0': speed = NORMAL_SPEED; break;
+            default: continue;
+        }
+        if (speed < MIN_SPEED) speed = MIN_SPEED;
+        if (speed > MAX_SPEED) speed = MAX_SPEED;
+        m_clock.setSpeed(speed, now_nsec());
+        std::printf("Tempo %d.%d %%\n", speed / 10, speed % 10);
+        std::fflush(stdout);
+    }
+}
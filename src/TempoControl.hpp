@@ -0,0 +1,35 @@
+#ifndef FM_TEMPO_CONTROL_HPP
+#define FM_TEMPO_CONTROL_HPP
+
+#include "SongClock.hpp"
+#include <pthread.h>
+
+#define MIN_SPEED 100
+#define MAX_SPEED 4000
+
+/* Changes the speed of a SongClock with the keyboard while the song
+ * plays: + and - by 1 %, > and < by 0.1 %, 0 back to the song's own
+ * tempo. A thread of its own reads the keys from stdin, so the play
+ * loop never waits for it. If stdin is a terminal it is switched to
+ * unbuffered input without echo until stop().
+ */
+class TempoControl
+{
+    private:
+    SongClock &m_clock;
+    pthread_t m_thread;
+    bool m_running;
+
+    TempoControl(TempoControl const &other);
+    TempoControl& operator=(TempoControl const &other);
+
+    public:
+    TempoControl(SongClock &clock);
+    ~TempoControl();
+
+    void start();
+    void stop();
+    void loop();
+};
+
+#endif
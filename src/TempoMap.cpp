@@ -0,0 +1,75 @@
+#include "TempoMap.hpp"
+#include "MidiEvents.hpp"
+#include <algorithm>
+
+// 120 BPM, if the song doesn't say otherwise
+#define DEFAULT_MPQN 500000
+
+
+/* a * b / c without the overflow of a * b, as long as (c - 1) * b
+ * fits. Rounds down.
+ */
+static long long mul_div(long long a, long long b, long long c)
+{
+    return a / c * b + a % c * b / c;
+}
+
+
+/* Build the tempo map from the tempo events of the timeline track (the
+ * first track of a MIDI file)
+ */
+TempoMap::TempoMap(int time_division, MidiTrack *timeline) :
+    m_time_division(time_division)
+{
+    Segment first = {0, 0, DEFAULT_MPQN};
+    m_segments.push_back(first);
+    for (EventList::iterator event = timeline->begin();
+            event != timeline->end(); ++event)
+    {
+        if ((*event)->type() != Event_Tempo) continue;
+        TempoEvent *tempo = dynamic_cast<TempoEvent*>(*event);
+        Segment next;
+        next.tick = tempo->absolute_ticks;
+        next.nsec = nsec(next.tick);
+        next.mpqn = (long long)tempo->getMpqn();
+        if (m_segments.back().tick == next.tick)
+        {
+            // Two tempo changes at once, the later one wins
+            m_segments.back() = next;
+        }
+        else
+        {
+            m_segments.push_back(next);
+        }
+    }
+}
+
+
+bool TempoMap::before(long long tick, Segment const &segment)
+{
+    return tick < segment.tick;
+}
+
+
+/* Returns the time of the given absolute tick in nanoseconds */
+long long TempoMap::nsec(long long tick) const
+{
+    if (m_time_division & 0x8000)
+    {
+        // SMPTE: the high byte is the negative number of frames per
+        // second, 29 meaning 29.97 (drop frame), the low byte the ticks
+        // per frame
+        int fps = -(signed char)(m_time_division >> 8);
+        int ticks_per_frame = m_time_division & 0xFF;
+        if (fps == 29)
+        {
+            return mul_div(tick, 1001000000LL, 30000LL * ticks_per_frame);
+        }
+        return mul_div(tick, 1000000000LL, (long long)fps * ticks_per_frame);
+    }
+    // The last segment that starts at or before tick
+    std::vector<Segment>::const_iterator segment = std::upper_bound(
+            m_segments.begin(), m_segments.end(), tick, before) - 1;
+    return segment->nsec + mul_div(tick - segment->tick,
+            segment->mpqn * 1000, m_time_division);
+}
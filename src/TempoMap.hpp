@@ -0,0 +1,40 @@
+#ifndef FM_TEMPO_MAP_HPP
+#define FM_TEMPO_MAP_HPP
+
+#include "MidiTrack.hpp"
+#include <vector>
+
+/* Converts MIDI ticks into nanoseconds since the start of the song.
+ *
+ * The tempo changes of the timeline track are turned into segments of
+ * constant tempo, each knowing the exact time it starts at. A tick is
+ * converted from the start of its segment with integer arithmetic, so
+ * rounding errors can't add up over the events of a song, no matter how
+ * long it is or how often the tempo changes.
+ *
+ * Time divisions in SMPTE frames are supported as well, tempo changes
+ * don't matter for them.
+ */
+class TempoMap
+{
+    private:
+    struct Segment
+    {
+        long long tick;
+        long long nsec;
+        // Microseconds per quarter note
+        long long mpqn;
+    };
+
+    int m_time_division;
+    std::vector<Segment> m_segments;
+
+    static bool before(long long tick, Segment const &segment);
+
+    public:
+    TempoMap(int time_division, MidiTrack *timeline);
+
+    long long nsec(long long tick) const;
+};
+
+#endif
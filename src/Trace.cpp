@@ -0,0 +1,162 @@
+#include "Trace.hpp"
+
+#ifdef FM_TRACE
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct TraceEvent
+{
+    char const *name;
+    long long start;
+    long long end;
+};
+
+struct TraceBuffer
+{
+    int tid;
+    char const *thread_name;
+    // Written by the owning thread only
+    unsigned int count;
+    unsigned long dropped;
+    TraceBuffer *next;
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+static __thread TraceBuffer *own_buffer = 0;
+// All buffers, new ones are pushed to the front
+static TraceBuffer *buffers = 0;
+static std::string trace_path;
+static bool tracing = false;
+
+
+long long trace_now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/* The buffer of the calling thread, created on first use. Its pages
+ * are touched right away, so recording never waits for a page fault.
+ */
+static TraceBuffer *buffer()
+{
+    if (own_buffer) return own_buffer;
+    TraceBuffer *b = static_cast<TraceBuffer*>(std::malloc(sizeof(TraceBuffer)));
+    if (!b) return 0;
+    std::memset(b, 0, sizeof(TraceBuffer));
+    b->tid = syscall(SYS_gettid);
+    b->thread_name = 0;
+    b->count = 0;
+    b->dropped = 0;
+    b->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers, &b->next, b, false,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    own_buffer = b;
+    return b;
+}
+
+
+void trace_event(char const *name, long long start, long long end)
+{
+    if (!tracing) return;
+    TraceBuffer *b = buffer();
+    if (!b) return;
+    if (b->count == TRACE_BUFFER_EVENTS)
+    {
+        ++b->dropped;
+        return;
+    }
+    TraceEvent &e = b->events[b->count];
+    e.name = name;
+    e.start = start;
+    e.end = end;
+    __atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+}
+
+
+/* Name the calling thread in the trace and set up its buffer. Threads
+ * with a loop that is timed call it before the loop, so that the
+ * buffer isn't allocated during their first round.
+ */
+void trace_thread(char const *name)
+{
+    if (!tracing) return;
+    TraceBuffer *b = buffer();
+    if (b) b->thread_name = name;
+}
+
+
+/* Write the events of all threads as trace event JSON. Threads that
+ * still run keep recording, their new events are left out.
+ */
+static void dump()
+{
+    FILE *f = std::fopen(trace_path.c_str(), "w");
+    if (!f)
+    {
+        std::perror(trace_path.c_str());
+        return;
+    }
+    int pid = getpid();
+    bool first = true;
+    std::fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (TraceBuffer *b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+            b; b = b->next)
+    {
+        if (b->thread_name)
+        {
+            std::fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",", pid, b->tid, b->thread_name);
+            first = false;
+        }
+        unsigned int count = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            TraceEvent const &e = b->events[i];
+            std::fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+                    "\"tid\":%d,\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}",
+                    first ? "" : ",", e.name, pid, b->tid,
+                    e.start / 1000, e.start % 1000,
+                    (e.end - e.start) / 1000, (e.end - e.start) % 1000);
+            first = false;
+        }
+        if (b->dropped)
+        {
+            std::fprintf(stderr, "Trace: thread %d dropped %lu events\n",
+                    b->tid, b->dropped);
+        }
+    }
+    std::fprintf(f, "\n]}\n");
+    std::fclose(f);
+}
+
+
+/* Record the trace events from now on and write them to path when the
+ * process exits
+ */
+bool trace_start(std::string const &path)
+{
+    trace_path = path;
+    tracing = true;
+    trace_thread("main");
+    std::atexit(dump);
+    return true;
+}
+
+#else
+
+/* Not built with make TRACE=1, there is nothing to record */
+bool trace_start(std::string const &path)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef FM_TRACE_HPP
+#define FM_TRACE_HPP
+
+#include <string>
+
+/* Profiling with trace events that Chrome (chrome://tracing) and
+ * Perfetto can show. Built with make TRACE=1, TRACE_SCOPE(name) records
+ * how long the rest of the enclosing block takes, as a complete event
+ * of the calling thread. Without it the macros are empty and cost
+ * nothing.
+ *
+ * Every thread writes into a buffer of its own that only it appends
+ * to, so recording takes no locks. The buffers are written out as JSON
+ * when the process exits. A full buffer drops the events that follow.
+ * TRACE_THREAD(name) names the calling thread and allocates its buffer,
+ * threads call it before their loop. The names have to be string
+ * literals.
+ */
+
+#ifdef FM_TRACE
+
+// Events per thread, about 7 MB each
+#define TRACE_BUFFER_EVENTS (1 << 18)
+
+long long trace_now();
+void trace_event(char const *name, long long start, long long end);
+void trace_thread(char const *name);
+
+class TraceScope
+{
+    private:
+    char const *m_name;
+    long long m_start;
+
+    public:
+    TraceScope(char const *name) : m_name(name), m_start(trace_now()) {}
+    ~TraceScope() { trace_event(m_name, m_start, trace_now()); }
+};
+
+#define TRACE_CONCAT(a, b) a ## b
+#define TRACE_VARIABLE(line) TRACE_CONCAT(trace_scope_, line)
+#define TRACE_SCOPE(name) TraceScope TRACE_VARIABLE(__LINE__)(name)
+#define TRACE_THREAD(name) trace_thread(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD(name)
+
+#endif
+
+bool trace_start(std::string const &path);
+
+#endif
@@ -0,0 +1,230 @@
+#include "Transform.hpp"
+#include "MidiEvents.hpp"
+#include "Trace.hpp"
+#include <iostream>
+
+#define NOTE_KEY(channel, note) (((channel) << 7) | ((note) & 0x7F))
+
+
+/* drives is the list of all drives, group_count the number of drive
+ * groups in the config. The playable range of a group is the range
+ * every drive of the group can play. If that is less than an octave
+ * some notes can't be folded into it, which gets a warning.
+ */
+Transform::Transform(DriveList const &drives, int group_count) :
+    m_group(-1), m_min_length(0), m_min_velocity(0), m_dedup(false)
+{
+    NoteRange all = {0, 127};
+    m_ranges.resize(group_count + 1, all);
+    for (DriveList::const_iterator d = drives.begin();
+            d != drives.end(); ++d)
+    {
+        for (int g = 0; g <= group_count; ++g)
+        {
+            if (g != 0 && g != d->group + 1) continue;
+            if (d->low_note > m_ranges[g].low) m_ranges[g].low = d->low_note;
+            if (d->high_note < m_ranges[g].high) m_ranges[g].high = d->high_note;
+        }
+    }
+    for (int g = 0; g <= group_count; ++g)
+    {
+        if (m_ranges[g].low > m_ranges[g].high)
+        {
+            // The drives don't agree on a range, use the first one
+            for (DriveList::const_iterator d = drives.begin();
+                    d != drives.end(); ++d)
+            {
+                if (g == 0 || g == d->group + 1)
+                {
+                    m_ranges[g].low = d->low_note;
+                    m_ranges[g].high = d->high_note;
+                    break;
+                }
+            }
+        }
+        if (m_ranges[g].high - m_ranges[g].low < 11)
+        {
+            std::cerr << "Transform: ";
+            if (g == 0)
+            {
+                std::cerr << "All drives together";
+            }
+            else
+            {
+                std::cerr << "The drives of group " << g
+                    << " (in the order of the configuration)";
+            }
+            std::cerr << " only play the notes " << m_ranges[g].low << " to "
+                << m_ranges[g].high << ", less than an octave. Notes that "
+                "don't fit are played at the nearest end." << std::endl;
+        }
+    }
+}
+
+
+void Transform::transpose(int combination, int semitones)
+{
+    m_transpose[combination] = semitones;
+}
+
+
+void Transform::route(int combination, int group)
+{
+    m_route[combination] = group;
+}
+
+
+/* Play the notes that aren't routed anywhere else on the drives of
+ * group, instead of on any drive
+ */
+void Transform::setGroup(int group)
+{
+    m_group = group;
+}
+
+
+/* Notes that are shorter than nsec nanoseconds are dropped */
+void Transform::setMinLength(long long nsec)
+{
+    m_min_length = nsec;
+}
+
+
+/* Notes with a velocity below the given one are dropped */
+void Transform::setMinVelocity(int velocity)
+{
+    m_min_velocity = velocity;
+}
+
+
+/* If dedup is true a note is dropped if the same note is already
+ * playing on another channel
+ */
+void Transform::setDedup(bool dedup)
+{
+    m_dedup = dedup;
+}
+
+
+/* Returns the transposed note, folded into the range of the given drive
+ * group, or the end of the range that is closest if it doesn't fit
+ */
+int Transform::pitch(int source, int note, int group) const
+{
+    std::map<int, int>::const_iterator t = m_transpose.find(source);
+    if (t != m_transpose.end())
+    {
+        note += t->second;
+    }
+    NoteRange const &range = m_ranges[group + 1];
+    while (note < range.low && note + 12 <= 127) note += 12;
+    while (note > range.high && note - 12 >= 0) note -= 12;
+    // A range of less than an octave may not have the note at all
+    if (note < range.low) note = range.low;
+    if (note > range.high) note = range.high;
+    return note;
+}
+
+
+/* Returns the note that should be played for the given note from a
+ * track/channel combination and stores the drive group that should
+ * play it in group. For notes that don't go through apply(), like live
+ * input.
+ */
+int Transform::mapNote(int source, int note, int &group) const
+{
+    std::map<int, int>::const_iterator r = m_route.find(source);
+    group = (r != m_route.end()) ? r->second : m_group;
+    return pitch(source, note, group);
+}
+
+
+/* Apply the transformations to the given (merged) event list and return
+ * the resulting event list. Everything is done in a single pass over
+ * the events, notes that turn out to be too short when their NOTE OFF
+ * arrives are blanked out and the gaps are removed at the end. The
+ * events themselves are modified in place, no event is copied.
+ *
+ * Muted notes, repeated NOTE ONs, NOTE OFFs that don't end a playing
+ * note and events the player ignores anyway are dropped as well.
+ */
+EventList Transform::apply(EventList const &events) const
+{
+    TRACE_SCOPE("transform");
+    EventList result;
+    result.reserve(events.size());
+    // Indexed by NOTE_KEY(channel, original note)
+    std::map<int, OpenNote> open;
+    std::map<int, OpenNote>::iterator o;
+    // Number of kept notes playing per group and pitch, for dedup
+    std::map<int, int> sounding;
+    int key, group, note;
+
+    for (EventList::const_iterator event = events.begin();
+            event != events.end(); ++event)
+    {
+        if ((*event)->type() == Event_Note_On)
+        {
+            NoteOnEvent *e = dynamic_cast<NoteOnEvent*>(*event);
+            if (e->muted || e->getVelocity() < m_min_velocity) continue;
+            key = NOTE_KEY(e->getChannel(), e->getNote());
+            note = mapNote(e->source, e->getNote(), group);
+            // A note that is played again without being stopped keeps
+            // its drive anyway
+            if (open.find(key) != open.end()) continue;
+            if (m_dedup && sounding[((group + 1) << 7) | note] > 0) continue;
+            ++sounding[((group + 1) << 7) | note];
+            OpenNote n = {result.size(), e->absolute_nsec, note, group};
+            open[key] = n;
+            e->group = group;
+            e->setNote(note);
+            result.push_back(e);
+        }
+        else if ((*event)->type() == Event_Note_Off)
+        {
+            NoteOffEvent *e = dynamic_cast<NoteOffEvent*>(*event);
+            key = NOTE_KEY(e->getChannel(), e->getNote());
+            o = open.find(key);
+            if (o == open.end()) continue;
+            OpenNote n = o->second;
+            open.erase(o);
+            --sounding[((n.group + 1) << 7) | n.pitch];
+            if (e->absolute_nsec - n.absolute_nsec < m_min_length)
+            {
+                result[n.index] = 0;
+                continue;
+            }
+            e->group = n.group;
+            e->setNote(n.pitch);
+            result.push_back(e);
+        }
+        else if ((*event)->type() == Event_Lyrics
+                || (*event)->type() == Event_Text)
+        {
+            result.push_back(*event);
+        }
+    }
+
+    // Close the gaps and fix the relative times
+    size_t out = 0;
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        if (!result[i]) continue;
+        result[out] = result[i];
+        if (out == 0)
+        {
+            result[out]->relative_ticks = result[out]->absolute_ticks;
+            result[out]->relative_nsec = result[out]->absolute_nsec;
+        }
+        else
+        {
+            result[out]->relative_ticks = result[out]->absolute_ticks
+                - result[out-1]->absolute_ticks;
+            result[out]->relative_nsec = result[out]->absolute_nsec
+                - result[out-1]->absolute_nsec;
+        }
+        ++out;
+    }
+    result.resize(out);
+    return result;
+}
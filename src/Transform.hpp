@@ -0,0 +1,59 @@
+#ifndef FM_TRANSFORM_HPP
+#define FM_TRANSFORM_HPP
+
+#include "DriveConfig.hpp"
+#include "MidiTrack.hpp"
+#include <map>
+#include <vector>
+
+/* The transform stage runs once over the merged track before playback
+ * and throws out everything the drives can't (or shouldn't) play, so
+ * that the play loop only sees events it actually has to act on.
+ *
+ * Track/channel combinations use the same format as the mute set of
+ * MidiFile::mergedTracks(): (track_nr << 4) | channel_nr
+ */
+class Transform
+{
+    private:
+    struct NoteRange
+    {
+        int low;
+        int high;
+    };
+    struct OpenNote
+    {
+        size_t index;
+        long long absolute_nsec;
+        int pitch;
+        int group;
+    };
+
+    std::map<int, int> m_transpose;
+    std::map<int, int> m_route;
+    // Group of the notes that aren't routed, -1 for any drive
+    int m_group;
+    // Indexed by group + 1, the first entry is the range of notes
+    // without a group
+    std::vector<NoteRange> m_ranges;
+    long long m_min_length;
+    int m_min_velocity;
+    bool m_dedup;
+
+    int pitch(int source, int note, int group) const;
+
+    public:
+    Transform(DriveList const &drives, int group_count);
+
+    void transpose(int combination, int semitones);
+    void route(int combination, int group);
+    void setGroup(int group);
+    void setMinLength(long long nsec);
+    void setMinVelocity(int velocity);
+    void setDedup(bool dedup);
+
+    EventList apply(EventList const &events) const;
+    int mapNote(int source, int note, int &group) const;
+};
+
+#endif
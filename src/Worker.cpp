@@ -0,0 +1,215 @@
+#include "Worker.hpp"
+#include "AllocCheck.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int)
+{
+    interrupted = 1;
+}
+
+
+Worker::Worker(DriveControl &dmgr, int drive_count) :
+    m_dmgr(dmgr), m_dcount(drive_count), m_socket(-1), m_order(0),
+    m_dropped(0), m_state(drive_count, 0), m_applied(0), m_late_sum(0),
+    m_late_max(0)
+{
+    m_queue.reserve(WORKER_QUEUE);
+}
+
+
+Worker::~Worker()
+{
+    if (m_socket >= 0)
+    {
+        close(m_socket);
+    }
+}
+
+
+/* Open the UDP port. Returns false on error. */
+bool Worker::listen(int port)
+{
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (m_socket < 0 || bind(m_socket, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        std::cerr << "Worker: Can't listen on port " << port << ": "
+            << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/* The heap order of m_queue: the command due first on top */
+bool Worker::later(Queued const &a, Queued const &b)
+{
+    return a.due > b.due || (a.due == b.due && a.order > b.order);
+}
+
+
+/* Handle a single packet from the socket */
+void Worker::receive()
+{
+    unsigned char buffer[PACKET_SIZE];
+    sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(m_socket, buffer, PACKET_SIZE, 0,
+            (sockaddr*)&from, &from_len);
+    long long t1 = monotonic_nsec();
+    if (len != PACKET_SIZE) return;
+    Packet packet;
+    decode_packet(buffer, packet);
+    switch (packet.type)
+    {
+        case PACKET_SYNC:
+            packet.type = PACKET_SYNC_REPLY;
+            packet.b = t1;
+            packet.c = monotonic_nsec();
+            encode_packet(packet, buffer);
+            sendto(m_socket, buffer, PACKET_SIZE, 0, (sockaddr*)&from,
+                    from_len);
+            break;
+        case PACKET_COMMAND:
+        case PACKET_STATE:
+            if (packet.drive >= m_dcount) break;
+            // fall through
+        case PACKET_BYE:
+            if (m_queue.size() == WORKER_QUEUE)
+            {
+                // The next state repeat makes up for it
+                ++m_dropped;
+            }
+            else
+            {
+                Queued queued = {packet.a, m_order++, packet};
+                m_queue.push_back(queued);
+                std::push_heap(m_queue.begin(), m_queue.end(), later);
+            }
+            break;
+    }
+}
+
+
+void Worker::apply(Packet const &command, long long now)
+{
+    if (command.type == PACKET_BYE)
+    {
+        finish();
+        return;
+    }
+    if (command.type == PACKET_STATE && m_state[command.drive] == command.b)
+    {
+        // A command that got through
+        return;
+    }
+    m_state[command.drive] = command.b;
+    if (command.b)
+    {
+        m_dmgr.play(command.drive, command.b / 1000.0);
+    }
+    else
+    {
+        m_dmgr.stop(command.drive);
+    }
+    long long late = now - command.a;
+    ++m_applied;
+    m_late_sum += late;
+    if (late > m_late_max) m_late_max = late;
+}
+
+
+/* The song is over: silence every drive and report how punctual we
+ * were
+ */
+void Worker::finish()
+{
+    // Printing the report may allocate
+    ALLOC_CHECK_END();
+    for (int d = 0; d < m_dcount; ++d)
+    {
+        m_dmgr.stop(d);
+        m_state[d] = 0;
+    }
+    if (m_applied)
+    {
+        std::cout << "Applied " << m_applied << " commands, late by "
+            << m_late_sum / m_applied / 1000 << " us on average, "
+            << m_late_max / 1000 << " us at most" << std::endl;
+    }
+    if (m_dropped)
+    {
+        std::cout << "Dropped " << m_dropped << " commands, more than "
+            << WORKER_QUEUE << " were waiting" << std::endl;
+    }
+    m_applied = m_late_sum = m_late_max = 0;
+    m_dropped = 0;
+    ALLOC_CHECK_BEGIN();
+}
+
+
+/* Serve the coordinator until interrupted with Ctrl+C or SIGTERM, then
+ * silence every drive
+ */
+void Worker::run()
+{
+    // No SA_RESTART, ppoll() has to return on a signal
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = on_interrupt;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pollfd pfd = {m_socket, POLLIN, 0};
+    timespec timeout;
+    long long now, wait;
+    ALLOC_CHECK_BEGIN();
+    while (!interrupted)
+    {
+        now = monotonic_nsec();
+        while (!m_queue.empty() && m_queue.front().due <= now)
+        {
+            std::pop_heap(m_queue.begin(), m_queue.end(), later);
+            Packet command = m_queue.back().packet;
+            m_queue.pop_back();
+            apply(command, now);
+        }
+        if (m_queue.empty())
+        {
+            wait = 1000000000LL;
+        }
+        else
+        {
+            wait = m_queue.front().due - now;
+        }
+        timeout.tv_sec = wait / 1000000000LL;
+        timeout.tv_nsec = wait % 1000000000LL;
+        if (ppoll(&pfd, 1, &timeout, NULL) > 0)
+        {
+            receive();
+        }
+    }
+    ALLOC_CHECK_END();
+    for (int d = 0; d < m_dcount; ++d)
+    {
+        m_dmgr.stop(d);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+}
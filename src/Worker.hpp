@@ -0,0 +1,55 @@
+#ifndef FM_WORKER_HPP
+#define FM_WORKER_HPP
+
+#include "DriveControl.hpp"
+#include "Protocol.hpp"
+#include <vector>
+// Commands that can wait to be due at a time, more are dropped
+#define WORKER_QUEUE 4096
+
+/* The worker side of a distributed rig: receives the commands of a
+ * coordinator (see Cluster) and applies them to its own drives when
+ * they are due. Also answers the clock offset requests.
+ */
+class Worker
+{
+    private:
+    struct Queued
+    {
+        long long due;
+        // Commands due at the same time are applied in order
+        unsigned long order;
+        Packet packet;
+    };
+
+    DriveControl &m_dmgr;
+    int m_dcount;
+    int m_socket;
+    // Commands by the time they are due, a heap (see later()) that
+    // never grows beyond WORKER_QUEUE so receiving doesn't allocate
+    std::vector<Queued> m_queue;
+    unsigned long m_order;
+    unsigned long m_dropped;
+    // What every drive plays in mHz, 0 if it's silent
+    std::vector<long long> m_state;
+    long long m_applied;
+    long long m_late_sum;
+    long long m_late_max;
+
+    Worker(Worker const &other);
+    Worker& operator=(Worker const &other);
+
+    static bool later(Queued const &a, Queued const &b);
+    void receive();
+    void apply(Packet const &command, long long now);
+    void finish();
+
+    public:
+    Worker(DriveControl &dmgr, int drive_count);
+    ~Worker();
+
+    bool listen(int port);
+    void run();
+};
+
+#endif
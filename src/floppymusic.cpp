@@ -0,0 +1,111 @@
+#include "floppymusic.h"
+#include "CatchUp.hpp"
+#include "Rig.hpp"
+#include "Song.hpp"
+#include "SongClock.hpp"
+#include "TempoControl.hpp"
+#include "Transform.hpp"
+#include "version.hpp" // generated by Makefile
+#include <time.h>
+
+struct fm_rig
+{
+    Rig rig;
+    // Kept between songs, so is the tempo
+    SongClock clock;
+
+    fm_rig() : clock(NORMAL_SPEED) {}
+};
+
+struct fm_song
+{
+    Song song;
+};
+
+
+char const *fm_version(void)
+{
+    return FM_VERSION;
+}
+
+
+fm_rig *fm_rig_open(char const *config_path, char const *head_state_path)
+{
+    fm_rig *rig = new fm_rig;
+    if (!rig->rig.read(config_path) || !rig->rig.open())
+    {
+        delete rig;
+        return 0;
+    }
+    if (head_state_path)
+    {
+        rig->rig.setHeadState(head_state_path);
+    }
+    rig->rig.start();
+    return rig;
+}
+
+
+void fm_rig_close(fm_rig *rig)
+{
+    delete rig;
+}
+
+
+int fm_rig_drives(fm_rig const *rig)
+{
+    return rig->rig.drives().size();
+}
+
+
+fm_song *fm_song_open(fm_rig *rig, char const *path)
+{
+    fm_song *song = new fm_song;
+    if (!song->song.read(path))
+    {
+        delete song;
+        return 0;
+    }
+    song->song.apply(Transform(rig->rig.drives(),
+                rig->rig.config().getGroups().size()));
+    return song;
+}
+
+
+long long fm_song_duration(fm_song *song)
+{
+    return song->song.duration();
+}
+
+
+void fm_song_close(fm_song *song)
+{
+    delete song;
+}
+
+
+int fm_play(fm_rig *rig, fm_song *song, double drop_factor)
+{
+    CatchUp catch_up(CATCH_UP_NONE, song->song.events());
+    return rig->rig.play(song->song, rig->clock, catch_up, drop_factor)
+        ? 0 : 1;
+}
+
+
+void fm_stop(fm_rig *rig)
+{
+    rig->rig.stop();
+}
+
+
+int fm_set_tempo(fm_rig *rig, int per_mille)
+{
+    if (per_mille < MIN_SPEED || per_mille > MAX_SPEED)
+    {
+        return -1;
+    }
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    rig->clock.setSpeed(per_mille, t.tv_sec * 1000000000LL + t.tv_nsec);
+    return 0;
+}
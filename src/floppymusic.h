@@ -0,0 +1,60 @@
+#ifndef FM_FLOPPYMUSIC_H
+#define FM_FLOPPYMUSIC_H
+
+/* The C interface of libfloppymusic, for programs that play songs on
+ * their floppy drives themselves instead of starting floppymusic (the
+ * C++ interface is Rig and Song):
+ *
+ *     fm_rig *rig = fm_rig_open("drives.cfg", NULL);
+ *     fm_song *song = fm_song_open(rig, "song.mid");
+ *     fm_play(rig, song, 1);
+ *     fm_song_close(song);
+ *     fm_rig_close(rig);
+ *
+ * Errors are printed to stderr. fm_stop() and fm_set_tempo() can be
+ * called from another thread while fm_play() plays, everything else
+ * has to come from one thread at a time.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fm_rig fm_rig;
+typedef struct fm_song fm_song;
+
+/* The version of the library, like the one floppymusic prints */
+char const *fm_version(void);
+
+/* Read the drive configuration, set up what the drives are connected to
+ * and reseed them. With a head_state path the head positions are kept
+ * there between runs (like --head-state), it may be NULL. Returns NULL
+ * on error.
+ */
+fm_rig *fm_rig_open(char const *config_path, char const *head_state_path);
+void fm_rig_close(fm_rig *rig);
+int fm_rig_drives(fm_rig const *rig);
+
+/* Read a MIDI file and fold its notes into the range of the drives of
+ * rig. Returns NULL on error.
+ */
+fm_song *fm_song_open(fm_rig *rig, char const *path);
+/* The length of the song in ns */
+long long fm_song_duration(fm_song *song);
+void fm_song_close(fm_song *song);
+
+/* Play the song and return when it is over (0) or after fm_stop() (1).
+ * The frequencies are divided by drop_factor, 2 plays an octave lower.
+ */
+int fm_play(fm_rig *rig, fm_song *song, double drop_factor);
+void fm_stop(fm_rig *rig);
+/* Play at per_mille of the song's tempo, 1000 being the song's own,
+ * from now on. Returns -1 if it's out of range (100 to 4000).
+ */
+int fm_set_tempo(fm_rig *rig, int per_mille);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
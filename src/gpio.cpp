@@ -1,3 +1,5 @@
+// The peripherals of the Pi 4 are above 2 GB, too far for a 32 bit off_t
+#define _FILE_OFFSET_BITS 64
 #include "gpio.hpp"
 
 #include <stdio.h>
@@ -11,15 +13,54 @@ void *gpio_map;
 volatile unsigned *gpio;
 
 
+//
+// Read a big endian 32 bit cell of the device tree
+//
+static unsigned long long read_cell(FILE *f, long offset, bool *ok) {
+   unsigned char cell[4];
+   if (fseek(f, offset, SEEK_SET) != 0 || fread(cell, 1, 4, f) != 4) {
+      *ok = false;
+      return 0;
+   }
+   return ((unsigned long long)cell[0] << 24) | (cell[1] << 16)
+      | (cell[2] << 8) | cell[3];
+}
+
+
+//
+// Find the physical address of the peripherals. The first range of
+// /proc/device-tree/soc/ranges maps the bus address 0x7e000000 to it,
+// with a 32 bit parent address on the older Pis and a 64 bit one
+// (whose upper half is 0 here) on the Pi 4. Falls back to the address
+// chosen at compile time (MODEL=PI2) without a device tree.
+//
+unsigned long long peripheral_base() {
+   FILE *f = fopen("/proc/device-tree/soc/ranges", "rb");
+   if (!f) {
+      return BCM2708_PERI_BASE;
+   }
+   bool ok = true;
+   unsigned long long base = read_cell(f, 4, &ok);
+   if (ok && base == 0) {
+      base = read_cell(f, 8, &ok);
+   }
+   fclose(f);
+   return ok && base ? base : BCM2708_PERI_BASE;
+}
+
+
 #ifndef NOGPIO
 //
-// Set up a memory regions to access GPIO
+// Set up a memory regions to access GPIO. Returns false if that failed,
+// which it does if we aren't root.
 //
-void setup_io() {
+bool setup_io() {
+   unsigned long long gpio_base = peripheral_base() + GPIO_OFFSET;
+
    /* open /dev/mem */
    if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
-      printf("can't open /dev/mem \n");
-      exit(-1);
+      fprintf(stderr, "can't open /dev/mem \n");
+      return false;
    }
 
    /* mmap GPIO */
@@ -29,19 +70,20 @@ void setup_io() {
       PROT_READ|PROT_WRITE,// Enable reading & writting to mapped memory
       MAP_SHARED,       //Shared with other processes
       mem_fd,           //File to map
-      GPIO_BASE         //Offset to GPIO peripheral
+      gpio_base         //Offset to GPIO peripheral
    );
 
    close(mem_fd); //No need to keep mem_fd open after mmap
 
    if (gpio_map == MAP_FAILED) {
-      printf("mmap error %p\n", gpio_map);//errno also set!
-      exit(-1);
+      fprintf(stderr, "mmap error at 0x%llx\n", gpio_base);//errno also set!
+      return false;
    }
 
    // Always use volatile pointer!
    gpio = (volatile unsigned *)gpio_map;
+   return true;
 }
 #else
-void setup_io() {}
+bool setup_io() { return true; }
 #endif
@@ -1,12 +1,13 @@
 #ifndef FM_GPIO_HPP
 #define FM_GPIO_HPP
 
+// Only used if the base can't be read from the device tree
 #ifdef PI_NEW_MODEL
 #define BCM2708_PERI_BASE        0x3F000000
 #else
 #define BCM2708_PERI_BASE        0x20000000
 #endif
-#define GPIO_BASE                (BCM2708_PERI_BASE + 0x200000) /* GPIO controller */
+#define GPIO_OFFSET              0x200000 /* GPIO controller */
 
 #define PAGE_SIZE (4*1024)
 #define BLOCK_SIZE (4*1024)
@@ -34,6 +35,7 @@ extern volatile unsigned *gpio;
 #define GPIO_CLR *(gpio+10) // clears bits which are 1 ignores bits which are 0
 
 
-void setup_io();
+bool setup_io();
+unsigned long long peripheral_base();
 
 #endif
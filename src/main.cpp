@@ -1,173 +1,458 @@
+#include "AllocCheck.hpp"
+#include "Analyzer.hpp"
 #include "Arguments.hpp"
+#include "Benchmark.hpp"
+#include "CatchUp.hpp"
+#include "Cluster.hpp"
+#include "Console.hpp"
 #include "DriveConfig.hpp"
 #include "DriveManager.hpp"
+#include "LiveInput.hpp"
 #include "MidiEvents.hpp"
-#include "MidiFile.hpp"
+#include "Metrics.hpp"
 #include "MidiTrack.hpp"
-#include "gpio.hpp"
+#include "Player.hpp"
+#include "Reactor.hpp"
+#include "Rig.hpp"
+#include "Song.hpp"
+#include "SongClock.hpp"
+#include "Renderer.hpp"
+#include "Stream.hpp"
+#include "TempoControl.hpp"
+#include "Trace.hpp"
+#include "Transform.hpp"
+#include "Worker.hpp"
 #include "version.hpp" // generated by Makefile
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <errno.h>
-#include <fstream>
 #include <iostream>
 #include <map>
 #include <sys/resource.h>
+#include <time.h>
 #include <unistd.h>
 #include <vector>
 
 
-// C C# D D# E F F# G G# A A# H
-static double frequencies[] = {261.626, 277.183, 293.665, 311.127, 329.628,
-                               349.228, 369.994, 391.995, 415.305, 440.000,
-                               466.164, 493.883};
+#define SEC_IN_NSEC (1000000000LL)
 
 
-/* Convert carriage-return characters in a string to newline chars.
- * Creates a copy of the string and returns the modified copy.
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * SEC_IN_NSEC + t.tv_nsec;
+}
+
+
+/* Configure the transform stage from the command line. Returns false
+ * if a route names an unknown drive group.
+ */
+static bool setup_transform(Transform &transform, DriveConfig const &drive_cfg)
+{
+    for (std::map<int, int>::iterator t = arguments.transpose.begin();
+            t != arguments.transpose.end(); ++t)
+    {
+        transform.transpose(t->first, t->second);
+    }
+    for (std::map<int, std::string>::iterator r = arguments.routes.begin();
+            r != arguments.routes.end(); ++r)
+    {
+        int group = drive_cfg.groupIndex(r->second);
+        if (group == -1)
+        {
+            std::cerr << "There is no drive group '" << r->second
+                << "' in " << arguments.cfg_path << std::endl;
+            return false;
+        }
+        transform.route(r->first, group);
+    }
+    transform.setMinLength(arguments.min_length * 1000000LL);
+    transform.setMinVelocity(arguments.min_velocity);
+    transform.setDedup(arguments.dedup);
+    return true;
+}
+
+
+/* Set up what the drives are connected to (see Rig::open()), where
+ * their head positions are kept and how far ahead the notes are sent.
+ * Returns false on error.
  */
-static std::string r_to_n(std::string s)
+static bool open_rig(Rig &rig)
 {
-    size_t it = 0;
-    while ((it = s.find("\r", it)) != std::string::npos)
+    DriveConfig const &drive_cfg = rig.config();
+    if (!drive_cfg.getChip().empty())
+    {
+        std::cout << "Setting up " << drive_cfg.getChip() << std::endl;
+    }
+    else if (drive_cfg.usesSpi())
+    {
+        SpiConfig config = drive_cfg.getSpi();
+        std::cout << "Setting up " << config.registers
+            << " shift registers on " << config.device << std::endl;
+    }
+    else
+    {
+        std::cout << "Setting up GPIO" << std::endl;
+    }
+    if (!rig.open())
+    {
+        return false;
+    }
+    if (!arguments.head_state.empty())
+    {
+        rig.setHeadState(arguments.head_state);
+    }
+    rig.setLookahead(arguments.lookahead * 1000000LL);
+    return true;
+}
+
+
+/* Tell whether the rig got the drive engine compiled for it (make
+ * FIXED_RIG=...)
+ */
+static void report_engine(Rig const &rig)
+{
+#ifdef FIXED_RIG
+    if (rig.fixedEngine())
+    {
+        std::cout << "Using the drive engine compiled for this rig"
+            << std::endl;
+        return;
+    }
+    std::cout << "The drive engine compiled for the rig can't play this "
+        "configuration, using the generic one" << std::endl;
+#endif
+}
+
+
+/* Reseed the drives and start the drive threads */
+static void start_rig(Rig &rig)
+{
+    rig.start();
+    report_engine(rig);
+}
+
+
+/* Play a song per drive group at the same time (--stream), all on the
+ * same drive engine. Returns false on error.
+ */
+static bool play_streams(Rig &rig)
+{
+    DriveConfig const &drive_cfg = rig.config();
+    DriveList const &drive_list = rig.drives();
+    if (arguments.reactor || !arguments.routes.empty()
+            || !drive_cfg.getRemotes().empty())
+    {
+        std::cerr << "Streams play on the drive groups of this host, they "
+            "can't be used with --reactor, --route or remote drives"
+            << std::endl;
+        return false;
+    }
+    if (!open_rig(rig))
+    {
+        return false;
+    }
+    std::cout << "Setting up drives" << std::endl;
+    if (arguments.metrics)
+    {
+        setup_metrics(drive_list.size(), rig.shardCount());
+    }
+    SharedControl control(rig.engine());
+    // Every stream sets the group of its notes when it loads
+    Transform transform(drive_list, drive_cfg.getGroups().size());
+    if (!setup_transform(transform, drive_cfg))
+    {
+        return false;
+    }
+
+    std::vector<Stream*> streams;
+    bool loaded = true;
+    for (std::map<std::string, std::string>::iterator s =
+            arguments.streams.begin();
+            loaded && s != arguments.streams.end(); ++s)
+    {
+        int group = drive_cfg.groupIndex(s->first);
+        if (group == -1)
+        {
+            std::cerr << "There is no drive group '" << s->first << "' in "
+                << arguments.cfg_path << std::endl;
+            loaded = false;
+            break;
+        }
+        std::cout << "Reading " << s->second << " for " << s->first
+            << std::endl;
+        streams.push_back(new Stream(s->first, group, s->second, control,
+                    drive_list, arguments.drop_factor, arguments.tempo));
+        loaded = streams.back()->load(transform, arguments.catch_up);
+    }
+
+    if (loaded)
+    {
+        start_rig(rig);
+        std::cout << "Ready, steady, go!" << std::endl;
+        setpriority(PRIO_PGRP, 0, -20);
+        long long start = now_nsec();
+        for (size_t s = 0; s < streams.size(); ++s)
+        {
+            streams[s]->start(start);
+        }
+        ALLOC_CHECK_BEGIN();
+        for (size_t s = 0; s < streams.size(); ++s)
+        {
+            streams[s]->join();
+        }
+        ALLOC_CHECK_END();
+        for (size_t s = 0; s < streams.size(); ++s)
+        {
+            streams[s]->report(std::cout);
+        }
+        std::cout << "Cleaning up" << std::endl;
+        teardown_metrics();
+    }
+    for (size_t s = 0; s < streams.size(); ++s)
     {
-        s.replace(it, 1, "\n");
+        delete streams[s];
     }
-    return s;
+    return loaded;
 }
 
-#define MASK(channel, note) (((channel) << 7) | ((note) & 0x7F))
 
-typedef std::vector<Drive*> vDrive;
 int main(int argc, char **argv)
 {
     std::cout << "[floppymusic " << FM_VERSION << "]" << std::endl;
     parse_args(argc, argv);
+    if (!arguments.trace_path.empty() && !trace_start(arguments.trace_path))
+    {
+        std::cerr << "Tracing isn't built in, rebuild with make TRACE=1"
+            << std::endl;
+    }
+    if (arguments.bench_parse)
+    {
+        return bench_parse(arguments.midi_path, std::cout) ? 0 : 1;
+    }
 
     std::cout << "Reading drive configuration " << arguments.cfg_path
         << std::endl;   
-    std::ifstream dc_file(arguments.cfg_path.c_str());
-    if (!dc_file.good())
+    Rig rig;
+    if (!rig.read(arguments.cfg_path, arguments.shards))
     {
-        std::cerr << "Can't open " << arguments.cfg_path << ": "
-            << std::strerror(errno) << std::endl;
         return 1;
     }
-
-    DriveConfig drive_cfg(dc_file);
-    if (!drive_cfg.isValid())
+    DriveConfig const &drive_cfg = rig.config();
+    DriveList const &drive_list = rig.drives();
+    if (rig.shardCount() > 1)
     {
-        std::cerr << "Invalid drive configuration. Aborting." << std::endl;
-        return 1;
+        if (arguments.reactor)
+        {
+            std::cerr << "Drive shards need a thread each, they can't be "
+                "used with --reactor" << std::endl;
+            return 1;
+        }
+        std::cout << "Using " << rig.shardCount() << " drive shards"
+            << std::endl;
+    }
+    if (arguments.bench_io)
+    {
+        if (drive_cfg.usesSpi() || !drive_cfg.getRemotes().empty())
+        {
+            std::cerr << "--bench-io needs drives on GPIO pins" << std::endl;
+            return 1;
+        }
+        std::string chip = drive_cfg.getChip();
+        return bench_io(drive_list, chip.empty() ? "/dev/gpiochip0" : chip,
+                std::cout) ? 0 : 1;
+    }
+    if (arguments.bench_engine)
+    {
+        if (drive_cfg.usesSpi() || !drive_cfg.getChip().empty()
+                || !drive_cfg.getRemotes().empty())
+        {
+            std::cerr << "--bench-engine needs drives on the GPIO registers"
+                << std::endl;
+            return 1;
+        }
+        return bench_engine(drive_list, std::cout) ? 0 : 1;
+    }
+    if (arguments.worker_port)
+    {
+        if (drive_list.size() > PACKET_MAX_DRIVES)
+        {
+            std::cerr << "A worker can't have more than " << PACKET_MAX_DRIVES
+                << " drives" << std::endl;
+            return 1;
+        }
+        if (!open_rig(rig))
+        {
+            return 1;
+        }
+        std::cout << "Setting up drives" << std::endl;
+        start_rig(rig);
+        Worker worker(rig.engine(), drive_list.size());
+        if (!worker.listen(arguments.worker_port))
+        {
+            return 1;
+        }
+        std::cout << "Waiting for commands on port " << arguments.worker_port
+            << std::endl;
+        setpriority(PRIO_PGRP, 0, -20);
+        worker.run();
+        rig.stop();
+        // Destroying the rig stops the drive threads and saves the head positions
+        std::cout << "Bye bye!" << std::endl;
+        return 0;
     }
 
-    std::cout << "Setting up GPIO" << std::endl;
-    setup_io();
+    if (!arguments.live_path.empty())
+    {
+        Transform transform(drive_list, drive_cfg.getGroups().size());
+        if (!setup_transform(transform, drive_cfg))
+        {
+            return 1;
+        }
+        if (!open_rig(rig))
+        {
+            return 1;
+        }
+        std::cout << "Setting up drives" << std::endl;
+        if (arguments.metrics)
+        {
+            setup_metrics(drive_list.size(), rig.shardCount());
+        }
+        start_rig(rig);
+        Player player(rig.engine(), drive_list, arguments.drop_factor, false);
+        LiveInput input(rig.engine(), player, transform,
+                arguments.min_velocity, drive_list.size());
+        if (!input.open(arguments.live_path))
+        {
+            return 1;
+        }
+        std::cout << "Listening on " << arguments.live_path << std::endl;
+        setpriority(PRIO_PGRP, 0, -20);
+        ALLOC_CHECK_BEGIN();
+        input.run();
+        ALLOC_CHECK_END();
+        input.report(std::cout);
+        teardown_metrics();
+        std::cout << "Bye bye!" << std::endl;
+        return 0;
+    }
 
-    std::cout << "Setting up drives" << std::endl;
-    DriveList drive_list = drive_cfg.getDrives();
-    DriveManager dmgr = DriveManager(drive_list);
-    dmgr.setup();
-    int dcount = drive_list.size();
+    if (!arguments.streams.empty())
+    {
+        return play_streams(rig) ? 0 : 1;
+    }
 
     std::cout << "Reading MIDI file" << std::endl;
-    std::ifstream midi_input(arguments.midi_path.c_str());
-    if (!midi_input.good())
+    Song song;
+    if (!song.read(arguments.midi_path, arguments.mute_tracks))
     {
-        std::cerr << "Error reading '" << arguments.midi_path << "': "
-            << std::strerror(errno) << std::endl;
         return 1;
     }
-    MidiFile midi;
-    if (!midi.read(midi_input))
+    std::cout << "Merged " << song.trackCount() << " tracks" << std::endl;
+
+    Transform transform(drive_list, drive_cfg.getGroups().size());
+    if (!setup_transform(transform, drive_cfg))
     {
-        std::cerr << "Invalid MIDI File. Aborting." << std::endl;
         return 1;
     }
-    if (midi.getFormatType() == 2)
+    song.apply(transform);
+    EventList &track = song.events();
+
+    if (arguments.analyze)
     {
-        std::cerr << "This is a MIDI file of type 2 and not supported "
-            "(yet) by floppymusic :(" << std::endl;
-        return 1;
+        Analyzer analyzer(drive_list, arguments.drop_factor);
+        analyzer.run(track);
+        analyzer.report(std::cout);
+        return 0;
+    }
+    if (!arguments.render_path.empty())
+    {
+        std::cout << "Rendering " << arguments.render_path << std::endl;
+        Renderer renderer(drive_list, arguments.drop_factor);
+        return renderer.render(track, arguments.render_path) ? 0 : 1;
     }
 
-    std::cout << "Merging " << (int)midi.getTrackCount() << " tracks"
-        << std::endl;
-    EventList track = midi.mergedTracks(arguments.mute_tracks);
-    std::cout << "Ready, steady, go!" << std::endl;
-    std::map<int, int> channel_map;
-    std::map<int, int>::iterator drive_index;
-    int pool_free = 0;
-    int new_index = -1;
-    unsigned int mask = 0;
-
-    /* Play loop */
-    setpriority(PRIO_PGRP, 0, -20);
-    for (EventList::iterator event = track.begin();
-            event != track.end(); ++event)
-    {
-        // Praise usleep
-        if ((*event)->relative_musec)
-        {
-            usleep((*event)->relative_musec);
-        }
-        if ((*event)->type() == Event_Note_Off)
-        {
-            NoteOffEvent* e = dynamic_cast<NoteOffEvent*>(*event);
-            if (e->muted) continue;
-            // Stop playing and release the drive back to the pool
-            mask = MASK(e->getChannel(), e->getNote());
-            drive_index = channel_map.find(mask);
-            if (drive_index != channel_map.end())
-            {
-                dmgr.stop(drive_index->second);
-                pool_free ^= 1 << drive_index->second;
-                channel_map.erase(drive_index);
-            }
-        }
-        else if ((*event)->type() == Event_Note_On)
-        {
-            NoteOnEvent* e = dynamic_cast<NoteOnEvent*>(*event);
-            if (e->muted) continue;
-            new_index = -1;
-            // See if the drive is already reserved
-            mask = MASK(e->getChannel(), e->getNote());
-            drive_index = channel_map.find(mask);
-            if (drive_index != channel_map.end())
-            {
-                new_index = drive_index->second;
-            }
-            else
-            {
-                // See if a drive is free
-                for (int check = 0; check < dcount; ++check)
-                {
-                    if (!(pool_free & (1 << check)))
-                    {
-                        // Device is free
-                        new_index = check;
-                        break; // stop searching for a drive
-                    }
-                }
-            }
-            if (new_index != -1)
-            {
-
-                channel_map[mask] = new_index;
-                dmgr.play(new_index,
-                    frequencies[e->getNote() % 12] / arguments.drop_factor);
-                pool_free |= 1 << new_index;
-            }
-        }
-        else if (arguments.lyrics && (*event)->type() == Event_Lyrics)
-        {
-            LyricsEvent* e = dynamic_cast<LyricsEvent*>(*event);
-            std::cout << r_to_n(e->getText()) << std::flush;
+    if (!drive_cfg.getRemotes().empty())
+    {
+        std::cout << "Connecting to workers" << std::endl;
+        Cluster cluster(drive_cfg.getRemotes(), drive_list,
+                arguments.playout_delay * 1000000LL);
+        if (!cluster.connect())
+        {
+            return 1;
         }
+        std::cout << "Ready, steady, go!" << std::endl;
+        Player player(cluster, drive_list, arguments.drop_factor,
+                arguments.lyrics);
+        setpriority(PRIO_PGRP, 0, -20);
+        console_start();
+        SongClock clock(arguments.tempo);
+        TempoControl tempo(clock);
+        if (arguments.tempo_keys) tempo.start();
+        ALLOC_CHECK_BEGIN();
+        cluster.run(track, player, clock);
+        ALLOC_CHECK_END();
+        tempo.stop();
+        console_stop();
+        std::cout << "Bye bye!" << std::endl;
+        return 0;
+    }
+
+    if (!open_rig(rig))
+    {
+        return 1;
+    }
+
+    std::cout << "Setting up drives" << std::endl;
+    if (arguments.metrics)
+    {
+        setup_metrics(drive_list.size(), rig.shardCount());
+    }
+    if (arguments.reactor)
+    {
+        DriveManager &dmgr = rig.reactor();
+        report_engine(rig);
+        dmgr.setup(false);
+
+        std::cout << "Ready, steady, go!" << std::endl;
+        Player player(dmgr, drive_list, arguments.drop_factor,
+                arguments.lyrics);
+        setpriority(PRIO_PGRP, 0, -20);
+        console_start();
+        Reactor reactor(dmgr, player);
+        SongClock clock(arguments.tempo);
+        TempoControl tempo(clock);
+        if (arguments.tempo_keys) tempo.start();
+        ALLOC_CHECK_BEGIN();
+        reactor.run(track, clock);
+        ALLOC_CHECK_END();
+        tempo.stop();
+        console_stop();
+    }
+    else
+    {
+        start_rig(rig);
+
+        std::cout << "Ready, steady, go!" << std::endl;
+        setpriority(PRIO_PGRP, 0, -20);
+        console_start();
+        SongClock clock(arguments.tempo);
+        TempoControl tempo(clock);
+        if (arguments.tempo_keys) tempo.start();
+        CatchUp catch_up(arguments.catch_up, track);
+        rig.play(song, clock, catch_up, arguments.drop_factor,
+                arguments.lyrics);
+        tempo.stop();
+        console_stop();
+        catch_up.report(std::cout);
+        LatencyStats wakeups = rig.engine().wakeups();
+        std::cout << "Drive thread wake-up latency: " << wakeups << " ("
+            << wakeups.count << " wake-ups)" << std::endl;
     }
 
     std::cout << "Cleaning up" << std::endl;
+    teardown_metrics();
     std::cout << "Bye bye!" << std::endl;
 }
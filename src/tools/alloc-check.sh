@@ -0,0 +1,69 @@
+#!/bin/sh
+# alloc-check.sh - plays src/tools/alloc-check.mid in every playback mode
+# through a floppymusic built with ALLOC_CHECK=abort and NOGPIO (make
+# alloc-check), so a heap allocation during playback aborts it.
+#
+# Usage: alloc-check.sh FLOPPYMUSIC
+FM=${1:?Usage: alloc-check.sh FLOPPYMUSIC}
+MIDI=$(dirname "$0")/alloc-check.mid
+DIR=$(mktemp -d) || exit 1
+WORKER=
+trap '[ -n "$WORKER" ] && kill $WORKER 2>/dev/null; rm -rf "$DIR"' EXIT
+PORT=${ALLOC_CHECK_PORT:-19300}
+
+cat > "$DIR/drives.cfg" <<EOF
+drive 2 3
+drive 4 5
+drive 6 7 group=left
+drive 8 9 group=left
+drive 10 11 group=right
+EOF
+echo "remote 127.0.0.1 $PORT 3" > "$DIR/remote.cfg"
+
+# Whether the output $1 doesn't report exactly 0 allocations
+allocated()
+{
+    ! grep -Eq '(^|[^0-9])0 heap allocations' "$1"
+}
+
+# Runs floppymusic with the given arguments, it has to finish without
+# an allocation during playback
+check()
+{
+    echo "alloc-check: $*"
+    "$FM" -c "$DIR/drives.cfg" "$@" > "$DIR/out" 2>&1
+    if [ $? -ne 0 ] || allocated "$DIR/out"
+    then
+        cat "$DIR/out"
+        echo "alloc-check: FAILED: $*"
+        exit 1
+    fi
+}
+
+check "$MIDI"
+check -l --lookahead 0 "$MIDI"
+check -r "$MIDI"
+check --shards 2 --catch-up compress "$MIDI"
+check --stream left="$MIDI" --stream right="$MIDI"
+printf '\220\074\144\220\100\144\200\074\000\200\100\000' > "$DIR/live"
+check --live "$DIR/live"
+
+# A coordinator and its worker, which checks itself until the song is
+# over
+echo "alloc-check: --worker $PORT and its coordinator"
+"$FM" -c "$DIR/drives.cfg" --worker $PORT > "$DIR/worker" 2>&1 &
+WORKER=$!
+sleep 1
+"$FM" -c "$DIR/remote.cfg" "$MIDI" > "$DIR/out" 2>&1
+STATUS=$?
+sleep 1
+if [ $STATUS -ne 0 ] || allocated "$DIR/out" \
+    || ! kill $WORKER 2>/dev/null || ! wait $WORKER \
+    || allocated "$DIR/worker"
+then
+    cat "$DIR/out" "$DIR/worker"
+    echo "alloc-check: FAILED: --worker"
+    exit 1
+fi
+WORKER=
+echo "alloc-check: OK"
@@ -0,0 +1,447 @@
+/* floppymusic-scan - parses every MIDI file of a library with a pool of
+ * threads and reports per file how well it fits a drive configuration,
+ * as CSV or JSON.
+ */
+#include "../DriveConfig.hpp"
+#include "../MidiEvents.hpp"
+#include "../MidiFile.hpp"
+#include "../Transform.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <pthread.h>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// Larger files are refused, a worker never holds more than one file
+#define MAX_FILE_SIZE (16 * 1024 * 1024)
+#define MAX_THREADS 256
+
+
+struct FileReport
+{
+    std::string path;
+    long long size;
+    // Empty if the file could be read
+    std::string error;
+    int format;
+    int tracks;
+    long long duration_nsec;
+    int notes;
+    int peak_polyphony;
+    int out_of_range;
+};
+
+struct Scan
+{
+    std::vector<FileReport> files;
+    // Index of the next file to take
+    size_t next;
+    // Folds the notes into the range of the drives they go to
+    Transform const *transform;
+};
+
+
+static void print_usage()
+{
+    std::cout << "Usage: floppymusic-scan [-c PATH] [-g GROUP] [-j THREADS] "
+        "[-f csv|json]\n"
+        "                        DIRECTORY|MIDIFILE ...\n"
+        "\n"
+        "-c PATH      The drive configuration (default drives.cfg)\n"
+        "-g GROUP     The drive group the files play on, as with\n"
+        "             floppymusic --stream GROUP=MIDIFILE (default: all\n"
+        "             drives)\n"
+        "-j THREADS   Files parsed at the same time (default: one per core)\n"
+        "-f FORMAT    csv (default) or json\n"
+        "\n"
+        "Directories are searched for .mid, .midi and .kar files. Notes are\n"
+        "out of range if they are outside the range every drive of the group\n"
+        "can play, so that floppymusic has to move them by octaves. The drop\n"
+        "factor doesn't change that, it only lowers what the drives play.\n"
+        "Files of type 2 can't be played by floppymusic and fail."
+        << std::endl;
+}
+
+
+static bool is_midi(std::string const &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = name.substr(dot + 1);
+    for (size_t i = 0; i < ext.size(); ++i)
+    {
+        ext[i] = std::tolower(ext[i]);
+    }
+    return ext == "mid" || ext == "midi" || ext == "kar";
+}
+
+
+/* Add the MIDI files below path to files. Symbolic links to
+ * directories aren't followed, so there can't be a loop.
+ */
+static void collect(std::string const &path, std::vector<FileReport> &files,
+        bool top)
+{
+    struct stat st;
+    if ((top ? stat(path.c_str(), &st) : lstat(path.c_str(), &st)) != 0)
+    {
+        std::cerr << path << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(path.c_str());
+        if (!dir)
+        {
+            std::cerr << path << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        std::vector<std::string> names;
+        dirent *entry;
+        while ((entry = readdir(dir)))
+        {
+            if (std::strcmp(entry->d_name, ".") && std::strcmp(entry->d_name, ".."))
+            {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        std::string prefix = path[path.size() - 1] == '/' ? path : path + "/";
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            collect(prefix + names[i], files, false);
+        }
+        return;
+    }
+    if (!S_ISREG(st.st_mode) || (!top && !is_midi(path)))
+    {
+        return;
+    }
+    FileReport report;
+    report.path = path;
+    report.size = st.st_size;
+    report.format = 0;
+    report.tracks = 0;
+    report.duration_nsec = 0;
+    report.notes = 0;
+    report.peak_polyphony = 0;
+    report.out_of_range = 0;
+    files.push_back(report);
+}
+
+
+/* Parse a single file and fill in its report */
+static void scan_file(FileReport &report, Transform const &transform)
+{
+    if (report.size > MAX_FILE_SIZE)
+    {
+        report.error = "larger than 16 MB";
+        return;
+    }
+    std::ifstream input(report.path.c_str(), std::ios::in | std::ios::binary);
+    if (!input.good())
+    {
+        report.error = std::strerror(errno);
+        return;
+    }
+    MidiFile midi;
+    std::ostringstream errors;
+    if (!midi.read(input, errors))
+    {
+        // Just the first message, without the prefix
+        std::string message = errors.str();
+        message = message.substr(0, message.find('\n'));
+        if (message.compare(0, 6, "MIDI: ") == 0) message.erase(0, 6);
+        report.error = message.empty() ? "invalid MIDI file" : message;
+        return;
+    }
+    report.format = midi.getFormatType();
+    report.tracks = midi.getTrackCount();
+    if (report.format == 2)
+    {
+        // Song::read() refuses them
+        report.error = "MIDI file of type 2, floppymusic can't play it";
+        return;
+    }
+
+    EventList events = midi.mergedTracks(std::set<int>());
+    // Playing notes, by channel/note
+    std::set<int> sounding;
+    for (EventList::const_iterator event = events.begin();
+            event != events.end(); ++event)
+    {
+        report.duration_nsec = (*event)->absolute_nsec;
+        if ((*event)->type() == Event_Note_On)
+        {
+            NoteOnEvent *e = dynamic_cast<NoteOnEvent*>(*event);
+            if (!sounding.insert((e->getChannel() << 7) | e->getNote()).second)
+            {
+                continue;
+            }
+            ++report.notes;
+            if ((int)sounding.size() > report.peak_polyphony)
+            {
+                report.peak_polyphony = sounding.size();
+            }
+            int group;
+            if (transform.mapNote(e->source, e->getNote(), group)
+                    != e->getNote())
+            {
+                ++report.out_of_range;
+            }
+        }
+        else if ((*event)->type() == Event_Note_Off)
+        {
+            NoteOffEvent *e = dynamic_cast<NoteOffEvent*>(*event);
+            sounding.erase((e->getChannel() << 7) | e->getNote());
+        }
+    }
+}
+
+
+static void *worker(void *arg)
+{
+    Scan *scan = static_cast<Scan*>(arg);
+    size_t i;
+    while ((i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED))
+            < scan->files.size())
+    {
+        scan_file(scan->files[i], *scan->transform);
+    }
+    return NULL;
+}
+
+
+static std::string csv_field(std::string const &s)
+{
+    if (s.find_first_of(",\"\n") == std::string::npos) return s;
+    std::string quoted = "\"";
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '"') quoted += '"';
+        quoted += s[i];
+    }
+    return quoted + "\"";
+}
+
+
+static std::string json_string(std::string const &s)
+{
+    std::ostringstream out;
+    out << '"';
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            std::sprintf(escaped, "\\u%04x", c);
+            out << escaped;
+        }
+        else
+        {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+
+static void print_csv(std::vector<FileReport> const &files)
+{
+    std::cout << "path,format,tracks,duration,notes,peak_polyphony,"
+        "out_of_range,error\n";
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        FileReport const &f = files[i];
+        std::cout << csv_field(f.path) << ",";
+        if (f.error.empty())
+        {
+            std::cout << f.format << "," << f.tracks << ","
+                << f.duration_nsec / 1000000000 << "."
+                << std::setw(3) << std::setfill('0')
+                << f.duration_nsec / 1000000 % 1000 << std::setfill(' ')
+                << "," << f.notes << "," << f.peak_polyphony << ","
+                << f.out_of_range << ",\n";
+        }
+        else
+        {
+            std::cout << ",,,,,," << csv_field(f.error) << "\n";
+        }
+    }
+}
+
+
+static void print_json(std::vector<FileReport> const &files)
+{
+    std::cout << "[";
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        FileReport const &f = files[i];
+        std::cout << (i ? ",\n" : "\n") << "  {\"path\": "
+            << json_string(f.path);
+        if (f.error.empty())
+        {
+            std::cout << ", \"format\": " << f.format
+                << ", \"tracks\": " << f.tracks
+                << ", \"duration\": " << f.duration_nsec / 1000000000 << "."
+                << std::setw(3) << std::setfill('0')
+                << f.duration_nsec / 1000000 % 1000 << std::setfill(' ')
+                << ", \"notes\": " << f.notes
+                << ", \"peak_polyphony\": " << f.peak_polyphony
+                << ", \"out_of_range\": " << f.out_of_range << "}";
+        }
+        else
+        {
+            std::cout << ", \"error\": " << json_string(f.error) << "}";
+        }
+    }
+    std::cout << "\n]" << std::endl;
+}
+
+
+static long long now_nsec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+int main(int argc, char **argv)
+{
+    std::string cfg_path = "drives.cfg";
+    std::string group_name;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool json = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:g:j:f:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                cfg_path = optarg;
+                break;
+            case 'g':
+                group_name = optarg;
+                break;
+            case 'j':
+                threads = std::atoi(optarg);
+                if (threads < 1 || threads > MAX_THREADS)
+                {
+                    std::cerr << "-j needs 1 to " << MAX_THREADS << " threads"
+                        << std::endl;
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (std::strcmp(optarg, "csv") && std::strcmp(optarg, "json"))
+                {
+                    print_usage();
+                    return 1;
+                }
+                json = !std::strcmp(optarg, "json");
+                break;
+            default:
+                print_usage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc)
+    {
+        print_usage();
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+
+    std::ifstream dc_file(cfg_path.c_str());
+    if (!dc_file.good())
+    {
+        std::cerr << "Can't open " << cfg_path << ": "
+            << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    DriveConfig drive_cfg(dc_file);
+    DriveList drives = drive_cfg.getDrives();
+    if (!drive_cfg.isValid() || drives.empty())
+    {
+        std::cerr << "Invalid drive configuration" << std::endl;
+        return 1;
+    }
+
+    // The same ranges floppymusic folds the notes into
+    Transform transform(drives, drive_cfg.getGroups().size());
+    if (!group_name.empty())
+    {
+        int group = drive_cfg.groupIndex(group_name);
+        if (group == -1)
+        {
+            std::cerr << "There is no drive group '" << group_name << "' in "
+                << cfg_path << std::endl;
+            return 1;
+        }
+        transform.setGroup(group);
+    }
+
+    Scan scan;
+    scan.next = 0;
+    scan.transform = &transform;
+    for (int i = optind; i < argc; ++i)
+    {
+        collect(argv[i], scan.files, true);
+    }
+
+    long long start = now_nsec();
+    if ((size_t)threads > scan.files.size())
+    {
+        threads = scan.files.size() ? scan.files.size() : 1;
+    }
+    std::vector<pthread_t> pool(threads);
+    for (long t = 0; t < threads; ++t)
+    {
+        pthread_create(&pool[t], NULL, worker, &scan);
+    }
+    for (long t = 0; t < threads; ++t)
+    {
+        pthread_join(pool[t], NULL);
+    }
+    long long elapsed = now_nsec() - start;
+
+    if (json)
+    {
+        print_json(scan.files);
+    }
+    else
+    {
+        print_csv(scan.files);
+    }
+    int failed = 0;
+    for (size_t i = 0; i < scan.files.size(); ++i)
+    {
+        if (!scan.files[i].error.empty()) ++failed;
+    }
+    std::cerr << "Scanned " << scan.files.size() << " files (" << failed
+        << " failed) in " << elapsed / 1000000 << " ms with " << threads
+        << " threads" << std::endl;
+    return 0;
+}
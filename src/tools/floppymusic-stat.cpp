@@ -0,0 +1,311 @@
+/* floppymusic-stat - shows the live metrics of a running floppymusic
+ * (started with --metrics), either as text or served in the Prometheus
+ * text format.
+ */
+#include "../Metrics.hpp"
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static void print_usage()
+{
+    std::cout << "Usage: floppymusic-stat [-w SECONDS] [-p PORT]\n"
+        "\n"
+        "-w SECONDS   Print the metrics every SECONDS seconds\n"
+        "-p PORT      Serve the metrics in the Prometheus text format on\n"
+        "             127.0.0.1:PORT" << std::endl;
+}
+
+
+// The mapped region, see open_region()
+static MetricsRegion const *region = 0;
+static ino_t region_inode = 0;
+static int region_pid = 0;
+
+
+static void close_region()
+{
+    if (region)
+    {
+        munmap(const_cast<MetricsRegion*>(region), sizeof(MetricsRegion));
+        region = 0;
+    }
+}
+
+
+/* Map the region unless it is mapped already. A floppymusic started
+ * after the one we mapped creates a new segment under the same name,
+ * then the old mapping is dropped for the new one. Returns false if
+ * there is no (complete) segment.
+ */
+static bool open_region()
+{
+    int fd = shm_open(METRICS_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        close_region();
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(MetricsRegion))
+    {
+        close(fd);
+        close_region();
+        return false;
+    }
+    if (region && st.st_ino == region_inode)
+    {
+        close(fd);
+        return true;
+    }
+    close_region();
+    void *map = mmap(NULL, sizeof(MetricsRegion), PROT_READ, MAP_SHARED,
+            fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    region = static_cast<MetricsRegion const*>(map);
+    region_inode = st.st_ino;
+    return true;
+}
+
+
+/* Takes a snapshot, returns false if the region is not (yet) usable */
+static bool snapshot(MetricsRegion &copy)
+{
+    if (!open_region())
+    {
+        std::cerr << "floppymusic doesn't seem to run (with --metrics)"
+            << std::endl;
+        return false;
+    }
+    metrics_snapshot(region, copy);
+    if (copy.magic != METRICS_MAGIC || copy.pid != region_pid)
+    {
+        // Another floppymusic took the segment over, or is still
+        // setting it up: map it again, its size may have changed
+        close_region();
+        if (!open_region())
+        {
+            std::cerr << "floppymusic doesn't seem to run (with --metrics)"
+                << std::endl;
+            return false;
+        }
+        metrics_snapshot(region, copy);
+        region_pid = copy.pid;
+    }
+    if (copy.magic != METRICS_MAGIC)
+    {
+        std::cerr << "floppymusic is still starting" << std::endl;
+        return false;
+    }
+    if (copy.version != METRICS_VERSION)
+    {
+        std::cerr << "Unknown metrics version " << copy.version << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/* The engine metrics of all shards together */
+static EngineMetrics engine_total(MetricsRegion const &m)
+{
+    EngineMetrics total;
+    std::memset(&total, 0, sizeof(total));
+    for (int s = 0; s < m.shard_count && s < METRICS_MAX_SHARDS; ++s)
+    {
+        EngineMetrics const &e = m.engine[s];
+        total.ticks += e.ticks;
+        total.tick_overruns += e.tick_overruns;
+        total.wakeups += e.wakeups;
+        if (e.worst_tick_lateness > total.worst_tick_lateness)
+        {
+            total.worst_tick_lateness = e.worst_tick_lateness;
+        }
+        if (e.worst_wake_latency > total.worst_wake_latency)
+        {
+            total.worst_wake_latency = e.worst_wake_latency;
+        }
+    }
+    return total;
+}
+
+
+static std::string text(MetricsRegion const &m)
+{
+    EngineMetrics engine = engine_total(m);
+    std::ostringstream out;
+    out << "pid " << m.pid << "\n"
+        << "ticks " << engine.ticks
+        << ", overruns " << engine.tick_overruns
+        << ", worst tick lateness " << engine.worst_tick_lateness / 1000
+        << " us\n"
+        << "wake-ups " << engine.wakeups
+        << ", worst wake-up latency " << engine.worst_wake_latency / 1000
+        << " us\n"
+        << "events " << m.play.events_played
+        << ", dropped notes " << m.play.notes_dropped
+        << ", worst event lateness " << m.play.worst_event_lateness / 1000
+        << " us\n";
+    for (int d = 0; d < m.drive_count && d < METRICS_MAX_DRIVES; ++d)
+    {
+        out << "drive " << d << ": ";
+        if (m.play.drive_note[d] == -1)
+        {
+            out << "-\n";
+        }
+        else
+        {
+            out << m.play.drive_note[d] << "\n";
+        }
+    }
+    return out.str();
+}
+
+
+static std::string prometheus(MetricsRegion const &m)
+{
+    EngineMetrics engine = engine_total(m);
+    std::ostringstream out;
+    out << "# TYPE floppymusic_ticks_total counter\n"
+        << "floppymusic_ticks_total " << engine.ticks << "\n"
+        << "# TYPE floppymusic_tick_overruns_total counter\n"
+        << "floppymusic_tick_overruns_total " << engine.tick_overruns << "\n"
+        << "# TYPE floppymusic_worst_tick_lateness_seconds gauge\n"
+        << "floppymusic_worst_tick_lateness_seconds "
+        << engine.worst_tick_lateness / 1e9 << "\n"
+        << "# TYPE floppymusic_wakeups_total counter\n"
+        << "floppymusic_wakeups_total " << engine.wakeups << "\n"
+        << "# TYPE floppymusic_worst_wake_latency_seconds gauge\n"
+        << "floppymusic_worst_wake_latency_seconds "
+        << engine.worst_wake_latency / 1e9 << "\n"
+        << "# TYPE floppymusic_events_played_total counter\n"
+        << "floppymusic_events_played_total " << m.play.events_played << "\n"
+        << "# TYPE floppymusic_notes_dropped_total counter\n"
+        << "floppymusic_notes_dropped_total " << m.play.notes_dropped << "\n"
+        << "# TYPE floppymusic_worst_event_lateness_seconds gauge\n"
+        << "floppymusic_worst_event_lateness_seconds "
+        << m.play.worst_event_lateness / 1e9 << "\n"
+        << "# TYPE floppymusic_drive_note gauge\n";
+    for (int d = 0; d < m.drive_count && d < METRICS_MAX_DRIVES; ++d)
+    {
+        out << "floppymusic_drive_note{drive=\"" << d << "\"} "
+            << m.play.drive_note[d] << "\n";
+    }
+    return out.str();
+}
+
+
+static int serve(int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        std::perror("floppymusic-stat");
+        return 1;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0)
+    {
+        std::perror("floppymusic-stat");
+        close(sock);
+        return 1;
+    }
+    for (;;)
+    {
+        int client = accept(sock, NULL, NULL);
+        if (client < 0) continue;
+        // We don't care about the request, there is only one page
+        char request[1024];
+        if (read(client, request, sizeof(request)) < 0)
+        {
+            close(client);
+            continue;
+        }
+        MetricsRegion m;
+        std::string body, header;
+        if (snapshot(m))
+        {
+            body = prometheus(m);
+            header = "HTTP/1.0 200 OK\r\n";
+        }
+        else
+        {
+            body = "floppymusic is not running\n";
+            header = "HTTP/1.0 503 Service Unavailable\r\n";
+        }
+        std::ostringstream response;
+        response << header
+            << "Content-Type: text/plain; version=0.0.4\r\n"
+            << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+        std::string r = response.str();
+        if (write(client, r.data(), r.size()) < 0)
+        {
+            std::perror("floppymusic-stat");
+        }
+        close(client);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int interval = 0;
+    int port = 0;
+    int c;
+    while ((c = getopt(argc, argv, "hw:p:")) != -1)
+    {
+        switch (c)
+        {
+            case 'w':
+                interval = std::atoi(optarg);
+                break;
+            case 'p':
+                port = std::atoi(optarg);
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    if (port)
+    {
+        return serve(port);
+    }
+    MetricsRegion m;
+    do
+    {
+        if (!snapshot(m))
+        {
+            return 1;
+        }
+        std::cout << text(m) << std::flush;
+        if (interval) sleep(interval);
+    } while (interval);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* fuzz-midi - fuzz target for the MIDI decoder (make fuzz). Every input
+ * goes through MidiFile::read() as a whole file and through
+ * MidiTrack::from_buffer() as the data of a single track chunk.
+ *
+ * Built with -DFM_LIBFUZZER it is a libFuzzer target. Without it, it
+ * decodes the files given on the command line (or stdin), which is what
+ * AFL and a replay of a corpus or a crash need.
+ */
+#include "../MidiFile.hpp"
+#include "../MidiTrack.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size)
+{
+    // The messages are of no interest, only crashes and leaks are
+    std::ostringstream errors;
+    std::string bytes(reinterpret_cast<char const*>(data), size);
+    std::istringstream input(bytes);
+    MidiFile midi;
+    if (midi.read(input, errors))
+    {
+        midi.mergedTracks(std::set<int>());
+    }
+    MidiTrack *track = MidiTrack::from_buffer(0, size ? data : 0, size, errors);
+    delete track;
+    return 0;
+}
+
+
+#ifndef FM_LIBFUZZER
+static void run(std::istream &input)
+{
+    std::vector<char> bytes((std::istreambuf_iterator<char>(input)),
+            std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(reinterpret_cast<uint8_t const*>(
+                bytes.empty() ? 0 : &bytes[0]), bytes.size());
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc == 1)
+    {
+        run(std::cin);
+        return 0;
+    }
+    for (int i = 1; i < argc; ++i)
+    {
+        std::ifstream input(argv[i], std::ios::in | std::ios::binary);
+        if (!input.good())
+        {
+            std::perror(argv[i]);
+            return 1;
+        }
+        run(input);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,66 @@
+# Turns a drive configuration into src/rig.hpp for make FIXED_RIG=...,
+# see FixedRig.hpp. Only drives on GPIO pins can be compiled in.
+
+function fail(message) {
+    print FILENAME ":" FNR ": " message > "/dev/stderr"
+    failed = 1
+    exit 1
+}
+
+BEGIN {
+    drives = 0
+    widths = 0
+}
+
+{
+    sub(/#.*/, "")
+    if (NF == 0) next
+    if ($1 != "drive") fail("only drive lines can be compiled in, not " $1)
+    if ($2 !~ /^[0-9]+$/ || $3 !~ /^[0-9]+$/ || $2 > 31 || $3 > 31)
+        fail("invalid pin")
+    pulse = 250
+    for (i = 4; i <= NF; ++i)
+        if ($i ~ /^pulse=/) pulse = substr($i, 7) + 0
+    direction[drives] = $2
+    stepper[drives] = $3
+    width[drives] = pulse
+    ++drives
+}
+
+END {
+    if (failed) exit 1
+    if (!drives) fail("no drives")
+    print "// Generated by src/tools/rig.awk, don't edit"
+    print "#ifndef FM_RIG_HPP"
+    print "#define FM_RIG_HPP"
+    print ""
+    print "#define RIG_DRIVES " drives
+    print ""
+    for (d = 0; d < drives; ++d) {
+        print "template <> struct RigDrive<" d ">"
+        print "{"
+        print "    static const int DIRECTION_PIN = " direction[d] ";"
+        print "    static const int STEPPER_PIN = " stepper[d] ";"
+        print "    static const int PULSE = " width[d] ";"
+        print "};"
+        if (!(width[d] in pins)) ++widths
+        pins[width[d]] += 2 ^ stepper[d]
+    }
+    # The pulse groups, shortest first like in GpioOutput
+    for (groups = 0; groups < widths; ++groups) {
+        shortest = -1
+        for (w in pins)
+            if (shortest == -1 || w + 0 < shortest + 0) shortest = w
+        print ""
+        print "template <> struct RigPulse<" groups ">"
+        print "{"
+        print "    static const int WIDTH = " shortest ";"
+        printf "    static const unsigned int PINS = 0x%xu;\n", pins[shortest]
+        print "};"
+        delete pins[shortest]
+    }
+    print ""
+    print "#define RIG_PULSE_GROUPS " groups
+    print ""
+    print "#endif"
+}
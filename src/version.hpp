@@ -0,0 +1,3 @@
+#ifndef FM_VERSION
+#define FM_VERSION "4ae10184-dirty"
+#endif